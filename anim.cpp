@@ -0,0 +1,98 @@
+#include <algorithm>
+#include <cmath>
+
+#include "anim.hpp"
+
+void Animations::reset(std::vector<Entity> const & entities)
+{
+    int n = entities.size();
+
+    src_x_px.assign(n, 0);
+    src_y_px.assign(n, 0);
+    dst_x_px.assign(n, 0);
+    dst_y_px.assign(n, 0);
+    t_s.assign(n, 0);
+    kind.assign(n, static_cast<uint8_t>(TweenType::none));
+    pos_x_px.assign(n, 0);
+    pos_y_px.assign(n, 0);
+
+    FOR(i,n) {
+        auto [ x_px, y_px ] = hex_to_pixel(entities[i].s, entities[i].t);
+        dst_x_px[i] = pos_x_px[i] = x_px;
+        dst_y_px[i] = pos_y_px[i] = y_px;
+    }
+}
+
+void Animations::start_turn(std::vector<Entity> const & entities)
+{
+    if (static_cast<int>(entities.size()) != size()) {
+        reset(entities);
+        return;
+    }
+
+    FOR(i,size()) {
+        Entity const & e = entities[i];
+        if (e.last_motion == TweenType::none) {
+            // Several turns can land between frames, and only the newest is
+            // animated. So an entity may have moved in one we never saw; put
+            // it where it is now, without disturbing a tween already heading there.
+            auto [ x, y ] = hex_to_pixel(e.s, e.t);
+            if (dst_x_px[i] != x || dst_y_px[i] != y) {
+                src_x_px[i] = dst_x_px[i] = x;
+                src_y_px[i] = dst_y_px[i] = y;
+                kind[i] = static_cast<uint8_t>(TweenType::none);
+            }
+            continue;
+        }
+
+        auto [ src_x, src_y ] = hex_to_pixel(e.motion_s, e.motion_t);
+        auto [ dst_x, dst_y ] = hex_to_pixel(e.s, e.t);
+
+        src_x_px[i] = src_x;
+        src_y_px[i] = src_y;
+        dst_x_px[i] = dst_x;
+        dst_y_px[i] = dst_y;
+        t_s[i] = 0;
+        kind[i] = static_cast<uint8_t>(e.last_motion);
+    }
+}
+
+void Animations::advance(double dt_s)
+{
+    uint8_t const NONE = static_cast<uint8_t>(TweenType::none);
+    uint8_t const BUMP = static_cast<uint8_t>(TweenType::bump);
+    float const dt = dt_s;
+    float const HALF_PI = M_PI / 2;
+
+    // Straight-line code with selects instead of branches, so it vectorises.
+    FOR(i,size()) {
+        float len = kind[i] == BUMP ? TWEEN_BUMP_LEN_S : TWEEN_MOVE_LEN_S;
+        float t = t_s[i] + dt;
+        bool active = kind[i] != NONE && t < len;
+
+        // Ease out: alpha = 1 - cos(pct * pi/2), by its Taylor series, which is
+        // well under a pixel off over a tile's width.
+        float y = active ? (len - t) / len * HALF_PI : 0;
+        float y2 = y*y;
+        float alpha = y2 * (0.5f - y2 * (1.0f/24 - y2 * (1.0f/720)));
+
+        // A bump goes halfway out and comes back.
+        float bump_alpha = 0.5f * std::min(alpha, 1 - alpha);
+        if (kind[i] == BUMP) alpha = bump_alpha;
+
+        pos_x_px[i] = static_cast<int>(dst_x_px[i] + std::floor((src_x_px[i] - dst_x_px[i]) * alpha + 0.5f));
+        pos_y_px[i] = static_cast<int>(dst_y_px[i] + std::floor((src_y_px[i] - dst_y_px[i]) * alpha + 0.5f));
+
+        t_s[i] = t;
+        kind[i] = active ? kind[i] : NONE;
+    }
+}
+
+bool Animations::any_active() const
+{
+    uint8_t const NONE = static_cast<uint8_t>(TweenType::none);
+    for (auto k : kind) {
+        if (k != NONE) return true;
+    }
+    return false;
+}
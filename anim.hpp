@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "hex_dance_dungeon.hpp"
+
+double const TWEEN_MOVE_LEN_S = 0.08;
+double const TWEEN_BUMP_LEN_S = 0.08;
+
+// Entity tweens, kept as parallel arrays with one slot per entry of
+// game->entities, and advanced once per frame.
+//
+// The rules only record what each entity did on a beat (Entity::last_motion);
+// this turns that into motion. Rendering just reads pos_x_px / pos_y_px.
+struct Animations
+{
+    std::vector<float> src_x_px, src_y_px;
+    std::vector<float> dst_x_px, dst_y_px;
+    std::vector<float> t_s;
+    std::vector<uint8_t> kind;  // TweenType
+
+    // Where to draw each entity this frame.
+    std::vector<int> pos_x_px, pos_y_px;
+
+    int size() const { return static_cast<int>(kind.size()); }
+
+    // Places every entity at rest on its tile.
+    void reset(std::vector<Entity> const & entities);
+
+    // Starts tweens for whatever the entities did on the beat just played.
+    void start_turn(std::vector<Entity> const & entities);
+
+    void advance(double dt_s);
+
+    bool any_active() const;
+};
@@ -0,0 +1,113 @@
+#include <cstdio>
+#include <cstring>
+
+#ifndef __EMSCRIPTEN__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "assetpack.hpp"
+
+std::vector<SpriteAsset> const SPRITE_ASSETS = {
+    { "data/tile_floor.png", 1 },
+    { "data/tile_wall.png", 1 },
+    { "data/tile_door_0.png", 1 },
+    { "data/tile_door_1.png", 1 },
+    { "data/tile_door_2.png", 1 },
+    { "data/heart_empty.png", 1 },
+    { "data/heart_full.png", 1 },
+    { "data/bat_blue.png", 1 },
+    { "data/bat_red.png", 1 },
+    { "data/slime_blue.png", 1 },
+    { "data/ghost.png", 2 },
+    { "data/skeleton_white.png", 2 },
+    { "data/telegraph_arrow_0.png", 1 },
+    { "data/telegraph_arrow_1.png", 1 },
+    { "data/telegraph_arrow_2.png", 1 },
+    { "data/telegraph_arrow_3.png", 1 },
+    { "data/telegraph_arrow_4.png", 1 },
+    { "data/telegraph_arrow_5.png", 1 },
+};
+
+const char * const FONT_ASSET = "data/Vera.ttf";
+
+int sprite_nframes(std::string const & path)
+{
+    for (auto& a : SPRITE_ASSETS) {
+        if (path == a.path) return a.nframes;
+    }
+    return 1;
+}
+
+bool AssetPack::open(const char * path)
+{
+    close();
+
+#ifdef __EMSCRIPTEN__
+    FILE * f = fopen(path, "rb");
+    if (!f) return false;
+    fseek(f, 0, SEEK_END);
+    buf.resize(ftell(f));
+    fseek(f, 0, SEEK_SET);
+    bool ok = fread(buf.data(), 1, buf.size(), f) == buf.size();
+    fclose(f);
+    if (!ok) return false;
+    base = buf.data();
+    size = buf.size();
+#else
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        ::close(fd);
+        return false;
+    }
+
+    void * p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) return false;
+
+    base = static_cast<uint8_t const *>(p);
+    size = st.st_size;
+#endif
+
+    PackHeader const * header = reinterpret_cast<PackHeader const *>(base);
+    if (size < sizeof(PackHeader)
+            || memcmp(header->magic, PACK_MAGIC, sizeof(PACK_MAGIC)) != 0
+            || header->version != PACK_VERSION
+            || size < sizeof(PackHeader) + header->nentries * sizeof(PackEntry)) {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void AssetPack::close()
+{
+#ifndef __EMSCRIPTEN__
+    if (base) munmap(const_cast<uint8_t *>(base), size);
+#endif
+    buf.clear();
+    base = NULL;
+    size = 0;
+}
+
+PackEntry const * AssetPack::find(std::string const & name) const
+{
+    if (!base) return NULL;
+
+    PackHeader const * header = reinterpret_cast<PackHeader const *>(base);
+    PackEntry const * entries = reinterpret_cast<PackEntry const *>(base + sizeof(PackHeader));
+
+    for (uint32_t i = 0; i < header->nentries; ++i) {
+        if (strncmp(entries[i].name, name.c_str(), sizeof(entries[i].name)) == 0) {
+            if (entries[i].offset + entries[i].size > size) return NULL;
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
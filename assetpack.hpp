@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Single-file asset pack: every sprite already decoded to RGBA32 pixels, plus
+// the font, so startup maps one file instead of opening and decoding ~20.
+// Built from data/ by packassets (make data/assets.pack).
+//
+// Layout: a PackHeader, nentries PackEntry records, then the blobs they point at.
+// Written in the building machine's byte order, which is little-endian everywhere we ship.
+
+char const PACK_MAGIC[8] = { 'H', 'D', 'D', 'P', 'A', 'C', 'K', '\0' };
+uint32_t const PACK_VERSION = 1;
+size_t const PACK_ALIGN = 16;
+
+uint32_t const PACK_KIND_IMAGE = 0;
+uint32_t const PACK_KIND_FONT = 1;
+
+struct PackHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t nentries;
+};
+
+struct PackEntry
+{
+    char name[64];      // path it was packed from, e.g. "data/ghost.png"
+    uint32_t kind;
+    uint32_t w, h;      // images: size in pixels, all frames side by side
+    uint32_t nframes;   // images: number of animation frames
+    uint64_t offset;    // from the start of the file
+    uint64_t size;      // in bytes
+};
+
+// Every sprite the game draws, with its number of animation frames.
+struct SpriteAsset
+{
+    const char * path;
+    int nframes;
+};
+
+extern std::vector<SpriteAsset> const SPRITE_ASSETS;
+extern const char * const FONT_ASSET;
+
+// Frames for a sprite in SPRITE_ASSETS; 1 for anything else.
+int sprite_nframes(std::string const & path);
+
+struct AssetPack
+{
+    AssetPack() {}
+    ~AssetPack() { close(); }
+
+    AssetPack(AssetPack const &) = delete;
+    AssetPack & operator=(AssetPack const &) = delete;
+
+    // Maps the pack at path. False if it's missing or not a pack of this version.
+    bool open(const char * path);
+    void close();
+
+    bool is_open() const { return base != NULL; }
+
+    PackEntry const * find(std::string const & name) const;
+    uint8_t const * blob(PackEntry const & e) const { return base + e.offset; }
+
+private:
+    uint8_t const * base = NULL;
+    size_t size = 0;
+    // Only used where there is no mmap.
+    std::vector<uint8_t> buf;
+};
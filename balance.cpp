@@ -0,0 +1,227 @@
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+
+// https://github.com/nlohmann/json
+#include "nlohmann/json.hpp"
+
+#include "bot.hpp"
+#include "parallel.hpp"
+
+using nlohmann::json;
+
+// Plays many seeded games per map on all cores with a simple greedy policy,
+// and writes where the player takes damage, dies and kills, plus how lethal
+// each enemy type is, to balance_<map>.json.
+//
+// usage: balance [games_per_map=1000] [threads=0] [map_path...]
+
+int const MAX_TURNS = 500;
+// Chance of a random action instead of the greedy one, so games differ more than their seeds do.
+double const EXPLORE_PROB = 0.1;
+
+int const NTYPES = static_cast<int>(EntityType::skeleton_white) + 1;
+
+struct TypeStats
+{
+    long spawned = 0;
+    long hits = 0;            // damage dealt to the player
+    long player_kills = 0;    // hits that took the player's last heart
+    long killed = 0;
+};
+
+// Counts for one map, over some set of games. The tile grid is the map's.
+struct BalanceStats : GameListener
+{
+    std::vector<long> damage, deaths, kills;
+    TypeStats types[NTYPES];
+    long games = 0, won = 0, lost = 0, turns = 0;
+
+    void resize(int ncells)
+    {
+        damage.assign(ncells, 0);
+        deaths.assign(ncells, 0);
+        kills.assign(ncells, 0);
+    }
+
+    void merge(BalanceStats const & o)
+    {
+        FOR(i,static_cast<int>(damage.size())) {
+            damage[i] += o.damage[i];
+            deaths[i] += o.deaths[i];
+            kills[i] += o.kills[i];
+        }
+        FOR(k,NTYPES) {
+            types[k].spawned += o.types[k].spawned;
+            types[k].hits += o.types[k].hits;
+            types[k].player_kills += o.types[k].player_kills;
+            types[k].killed += o.types[k].killed;
+        }
+        games += o.games;
+        won += o.won;
+        lost += o.lost;
+        turns += o.turns;
+    }
+
+    void player_hit(Entity const & by) override
+    {
+        int i = game->map().index(game->player_s, game->player_t);
+        TypeStats & ts = types[static_cast<int>(by.type)];
+        ++damage[i];
+        ++ts.hits;
+        if (game->player.health == 0) {
+            ++deaths[i];
+            ++ts.player_kills;
+        }
+    }
+
+    void enemy_killed(Entity const & e) override
+    {
+        ++kills[game->map().index(e.s, e.t)];
+        ++types[static_cast<int>(e.type)].killed;
+    }
+};
+
+static void play_one(BalanceStats & stats, std::string const & map_path, unsigned seed)
+{
+    GameState state;
+    state.prng.seed(seed);
+    game = &state;
+    listener = NULL;
+    warp_to_map(map_path);
+
+    // The "random" map has the same layout every time, only the enemies change;
+    // json maps are fixed. So one grid per map is enough.
+    if (stats.damage.empty()) stats.resize(state.map().ncells());
+    assert(static_cast<int>(stats.damage.size()) == state.map().ncells());
+
+    for (auto& e : state.entities) {
+        ++stats.types[static_cast<int>(e.type)].spawned;
+    }
+
+    BeamSearchBot policy;
+    policy.depth = 1;
+    policy.width = NDIRS+1;
+
+    std::minstd_rand rng(seed);
+    std::uniform_real_distribution<double> coin(0, 1);
+    std::uniform_int_distribution<int> any_action(-1, NDIRS-1);
+
+    listener = &stats;
+    int turns = 0;
+    while (turns < MAX_TURNS && !state.is_won() && !state.is_lost()) {
+        int action = coin(rng) < EXPLORE_PROB ? any_action(rng) : policy.choose(state);
+        move_player(action);
+        ++turns;
+    }
+    listener = NULL;
+
+    ++stats.games;
+    stats.won += state.is_won();
+    stats.lost += state.is_lost();
+    stats.turns += turns;
+}
+
+static std::string output_path(std::string const & map_path)
+{
+    std::string name = map_path;
+    size_t slash = name.find_last_of('/');
+    if (slash != std::string::npos) name = name.substr(slash+1);
+    size_t dot = name.find_last_of('.');
+    if (dot != std::string::npos) name = name.substr(0, dot);
+    return "balance_" + name + ".json";
+}
+
+static void write_heatmap(std::string const & map_path, BalanceStats const & stats)
+{
+    GameState state;
+    game = &state;
+    warp_to_map(map_path);
+    MapData const & map = state.map();
+
+    // Only tiles where something happened, in the same s/t record style as the maps.
+    json tiles = json::array();
+    FOR(i,map.ncells()) {
+        if (!stats.damage[i] && !stats.deaths[i] && !stats.kills[i]) continue;
+        tiles.push_back({
+            { "s", map.s_of(i) }, { "t", map.t_of(i) },
+            { "damage", stats.damage[i] }, { "deaths", stats.deaths[i] }, { "kills", stats.kills[i] } });
+    }
+
+    json enemies = json::object();
+    FR(k,1,NTYPES) {
+        TypeStats const & ts = stats.types[k];
+        if (!ts.spawned) continue;
+        enemies[Entity::serialize_type(static_cast<EntityType>(k))] = {
+            { "spawned", ts.spawned }, { "hits", ts.hits },
+            { "player_kills", ts.player_kills }, { "killed", ts.killed } };
+    }
+
+    json j;
+    j["map"] = map_path;
+    j["games"] = stats.games;
+    j["won"] = stats.won;
+    j["lost"] = stats.lost;
+    j["turns"] = stats.turns;
+    j["tiles"] = tiles;
+    j["enemies"] = enemies;
+
+    std::ofstream o(output_path(map_path));
+    o << j.dump() << "\n";
+}
+
+int main(int argc, char ** argv)
+{
+    int games_per_map = argc > 1 ? atoi(argv[1]) : 1000;
+    int n_threads = argc > 2 ? atoi(argv[2]) : 0;
+    if (games_per_map < 1) {
+        fprintf(stderr, "usage: balance [games_per_map=1000] [threads=0] [map_path...]\n");
+        return 1;
+    }
+
+    std::vector<std::string> maps = BUILTIN_MAPS;
+    if (argc > 3) maps.assign(argv + 3, argv + argc);
+
+    ThreadPool pool(n_threads);
+
+    printf("%-28s %6s %6s %6s %8s  %s\n", "map", "games", "won", "lost", "turns", "hits per spawned enemy");
+
+    auto start = std::chrono::steady_clock::now();
+    for (auto& map_path : maps) {
+        // Each chunk of games accumulates on its own, then the chunks are merged,
+        // so workers never share counters.
+        int n_chunks = std::min(games_per_map, pool.size() * 4);
+        std::vector<BalanceStats> chunks(n_chunks);
+
+        pool.parallel_for(n_chunks, [&](int c) {
+            for (int g = c; g < games_per_map; g += n_chunks) {
+                play_one(chunks[c], map_path, g + 1);
+            }
+        });
+
+        BalanceStats total;
+        total.resize(chunks[0].damage.size());
+        for (auto& c : chunks) total.merge(c);
+
+        write_heatmap(map_path, total);
+
+        printf("%-28s %6ld %6ld %6ld %8.1f ", map_path.c_str(), total.games, total.won, total.lost,
+                total.turns / static_cast<double>(total.games));
+        FR(k,1,NTYPES) {
+            TypeStats const & ts = total.types[k];
+            if (!ts.spawned) continue;
+            printf(" %s=%.2f", Entity::serialize_type(static_cast<EntityType>(k)) + 6,
+                    ts.hits / static_cast<double>(ts.spawned));
+        }
+        printf("\n");
+    }
+    double elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("%.2f s on %d threads\n", elapsed_s, pool.size());
+
+    return 0;
+}
@@ -0,0 +1,119 @@
+#include <algorithm>
+#include <cstdlib>
+
+#include "batch.hpp"
+
+using std::make_tuple;
+
+BatchEnv::BatchEnv(std::vector<std::string> const & map_paths, int n, unsigned seed, int nthreads)
+    : map_paths(map_paths), pool(nthreads)
+{
+    FOR(i,n) {
+        std::unique_ptr<GameState> g(new GameState);
+        g->prng.seed(seed + i);
+        envs.push_back(std::move(g));
+    }
+    turns.assign(n, 0);
+
+    observations.tiles.assign(n * OBS_TILES, OBS_UNKNOWN);
+    observations.entities.assign(n * OBS_MAX_ENTITIES * OBS_ENTITY_FIELDS, 0);
+    observations.health.assign(n, 0);
+    observations.reward.assign(n, 0);
+    observations.done.assign(n, 0);
+
+    reset();
+}
+
+void BatchEnv::reset()
+{
+    pool.parallel_for(size(), [this](int i) {
+        reset_one(i);
+        observations.reward[i] = 0;
+        observations.done[i] = 0;
+        observe_one(i);
+    });
+}
+
+void BatchEnv::step(int const * actions)
+{
+    pool.parallel_for(size(), [this, actions](int i) {
+        step_one(i, actions[i]);
+        observe_one(i);
+    });
+}
+
+void BatchEnv::reset_one(int i)
+{
+    game = envs[i].get();
+    warp_to_map(map_paths[i % map_paths.size()]);
+    turns[i] = 0;
+}
+
+void BatchEnv::step_one(int i, int action)
+{
+    game = envs[i].get();
+
+    int health_before = game->player.health;
+    int left_before = game->enemies_left();
+
+    move_player(action);
+    ++turns[i];
+
+    observations.reward[i] = (left_before - game->enemies_left()) - (health_before - game->player.health);
+
+    bool done = game->is_lost() || game->is_won() || turns[i] >= max_turns;
+    observations.done[i] = done;
+
+    if (done) reset_one(i);
+}
+
+void BatchEnv::observe_one(int i)
+{
+    game = envs[i].get();
+    int ps = game->player_s, pt = game->player_t;
+
+    uint8_t * tiles = &observations.tiles[i * OBS_TILES];
+    FR(dt, -OBS_RADIUS, OBS_RADIUS+1) {
+        FR(ds, -OBS_RADIUS, OBS_RADIUS+1) {
+            uint8_t code = OBS_UNKNOWN;
+            int s = ps+ds, t = pt+dt;
+
+            if (abs(ds+dt) <= OBS_RADIUS && game->explored(s, t)) {
+                switch (game->map().at(s, t)->type) {
+                case TileType::floor: code = OBS_FLOOR; break;
+                case TileType::wall: code = OBS_WALL; break;
+                case TileType::door: code = OBS_DOOR; break;
+                case TileType::none: break;
+                }
+                if (game->visible(s, t)) code |= OBS_VISIBLE;
+            }
+
+            tiles[(dt+OBS_RADIUS)*OBS_DIAM + (ds+OBS_RADIUS)] = code;
+        }
+    }
+
+    std::vector<std::tuple<int, Entity*>> seen;
+    for (auto& e : game->entities) {
+        if (e.is_dead) continue;
+        int dist = hex_dist(ps, pt, e.s, e.t);
+        if (dist > OBS_RADIUS) continue;
+        if (!game->visible(e.s, e.t)) continue;
+        seen.push_back(make_tuple(dist, &e));
+    }
+    std::sort(BEND(seen));
+
+    int8_t * ents = &observations.entities[i * OBS_MAX_ENTITIES * OBS_ENTITY_FIELDS];
+    FOR(k,OBS_MAX_ENTITIES) {
+        int8_t * slot = ents + k*OBS_ENTITY_FIELDS;
+        if (k < static_cast<int>(seen.size())) {
+            Entity * e = std::get<1>(seen[k]);
+            slot[0] = e->s - ps;
+            slot[1] = e->t - pt;
+            slot[2] = static_cast<int8_t>(e->type);
+        } else {
+            slot[0] = slot[1] = slot[2] = 0;
+        }
+    }
+
+    observations.health[i] = game->player.health;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "hex_dance_dungeon.hpp"
+#include "parallel.hpp"
+
+// Vectorised environment for training bots: N independent games,
+// all stepped by one call with one action each.
+//
+// Actions are move_player directions: 0..NDIRS-1, or -1 to wait a beat.
+
+// Observations cover a hex of this radius around the player,
+// stored as an OBS_DIAM x OBS_DIAM axial window indexed by (dt+R)*OBS_DIAM + (ds+R).
+int const OBS_RADIUS = 8;
+int const OBS_DIAM = 2*OBS_RADIUS + 1;
+int const OBS_TILES = OBS_DIAM*OBS_DIAM;
+
+// Tile codes. Tiles never seen (or outside the hex) are OBS_UNKNOWN.
+uint8_t const OBS_UNKNOWN = 0;
+uint8_t const OBS_FLOOR = 1;
+uint8_t const OBS_WALL = 2;
+uint8_t const OBS_DOOR = 3;
+// Or'd in when the tile is visible this turn, not just remembered.
+uint8_t const OBS_VISIBLE = 0x80;
+
+// Visible live enemies, nearest first: (ds, dt, EntityType) relative to the player.
+// Unused slots have type 0 (EntityType::none).
+int const OBS_MAX_ENTITIES = 32;
+int const OBS_ENTITY_FIELDS = 3;
+
+struct BatchObs
+{
+    std::vector<uint8_t> tiles;     // n * OBS_TILES
+    std::vector<int8_t> entities;   // n * OBS_MAX_ENTITIES * OBS_ENTITY_FIELDS
+    std::vector<int8_t> health;     // n
+    std::vector<float> reward;      // n: +1 per kill, -1 per hit taken, this step
+    std::vector<uint8_t> done;      // n: episode ended this step (the env has already been reset)
+};
+
+struct BatchEnv
+{
+    // Each env plays map_paths[i % map_paths.size()]; "random" is allowed.
+    // Env i seeds its RNG with seed+i, so a batch is reproducible.
+    BatchEnv(std::vector<std::string> const & map_paths, int n, unsigned seed, int nthreads = 0);
+
+    int size() const { return static_cast<int>(envs.size()); }
+
+    void reset();
+
+    // actions has size() entries. Finished episodes restart automatically.
+    void step(int const * actions);
+
+    BatchObs const & obs() const { return observations; }
+
+    // Episodes running longer than this are cut off and reported as done.
+    int max_turns = 1000;
+
+private:
+    void reset_one(int i);
+    void step_one(int i, int action);
+    void observe_one(int i);
+
+    std::vector<std::string> map_paths;
+    std::vector<std::unique_ptr<GameState>> envs;
+    std::vector<int> turns;
+    ThreadPool pool;
+    BatchObs observations;
+};
@@ -0,0 +1,38 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+#include "batch.hpp"
+
+// Steps a batch of games with random actions and reports throughput.
+//
+// usage: batchbench [map_path=random] [n_envs=256] [n_steps=1000] [n_threads=0]
+int main(int argc, char ** argv)
+{
+    std::string map_path = argc > 1 ? argv[1] : "random";
+    int n_envs = argc > 2 ? atoi(argv[2]) : 256;
+    int n_steps = argc > 3 ? atoi(argv[3]) : 1000;
+    int n_threads = argc > 4 ? atoi(argv[4]) : 0;
+
+    BatchEnv env({ map_path }, n_envs, 1, n_threads);
+
+    std::minstd_rand rng(2);
+    std::uniform_int_distribution<int> action_dist(-1, NDIRS-1);
+    std::vector<int> actions(n_envs);
+
+    long episodes = 0;
+    auto start = std::chrono::steady_clock::now();
+    FOR(step,n_steps) {
+        for (auto& a : actions) a = action_dist(rng);
+        env.step(actions.data());
+        FOR(i,n_envs) episodes += env.obs().done[i];
+    }
+    double elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("map=%s envs=%d steps=%d threads=%d\n", map_path.c_str(), n_envs, n_steps, n_threads);
+    printf("%.0f env-steps/s, %ld episodes finished, %.3f s\n",
+            n_envs * static_cast<double>(n_steps) / elapsed_s, episodes, elapsed_s);
+
+    return 0;
+}
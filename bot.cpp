@@ -0,0 +1,131 @@
+#include <algorithm>
+#include <climits>
+
+#include "bot.hpp"
+
+double const SCORE_WON = 1e6;
+double const SCORE_LOST = -1e6;
+double const SCORE_PER_HEALTH = 1000;
+double const SCORE_PER_KILL = 100;
+double const SCORE_PER_STEP = 1;
+// An enemy that will hit the player next beat unless the player moves.
+double const SCORE_PER_THREAT = 300;
+
+void BeamSearchBot::compute_target_dist(GameState const & state)
+{
+    MapData const & map = state.map();
+    target_dist.assign(map.ncells(), INT_MAX);
+
+    std::vector<int> q;
+    for (auto& e : state.entities) {
+        if (e.is_dead) continue;
+        int i = map.index(e.s, e.t);
+        if (i < 0 || target_dist[i] == 0) continue;
+        target_dist[i] = 0;
+        q.push_back(i);
+    }
+
+    for (size_t head = 0; head < q.size(); ++head) {
+        int i = q[head];
+        int s = map.s_of(i), t = map.t_of(i);
+
+        FOR(d,NDIRS) {
+            Tile const * tile = map.at(s + DIR_DS[d], t + DIR_DT[d]);
+            if (!tile || tile->type == TileType::wall) continue;
+
+            int j = map.index(s + DIR_DS[d], t + DIR_DT[d]);
+            if (target_dist[j] != INT_MAX) continue;
+            target_dist[j] = target_dist[i] + 1;
+            q.push_back(j);
+        }
+    }
+}
+
+double BeamSearchBot::evaluate(GameState const & state) const
+{
+    if (state.is_lost()) return SCORE_LOST;
+    if (state.is_won()) return SCORE_WON;
+
+    double score = SCORE_PER_HEALTH * state.player.health;
+    score -= SCORE_PER_KILL * state.enemies_left();
+
+    int i = state.map().index(state.player_s, state.player_t);
+    if (i >= 0 && i < static_cast<int>(target_dist.size()) && target_dist[i] != INT_MAX) {
+        score -= SCORE_PER_STEP * target_dist[i];
+    }
+
+    for (auto& e : state.entities) {
+        if (e.is_dead || !e.has_been_visible) continue;
+
+        bool threat = false;
+        if (e.prep_dir != -1) {
+            threat = e.s + DIR_DS[e.prep_dir] == state.player_s && e.t + DIR_DT[e.prep_dir] == state.player_t;
+        } else if (e.moveCooldown == 0 && !(e.type == EntityType::ghost && e.hiding)) {
+            threat = hex_dist(e.s, e.t, state.player_s, state.player_t) == 1
+                && (e.type == EntityType::skeleton_white || e.type == EntityType::ghost);
+        }
+        if (threat) score -= SCORE_PER_THREAT;
+    }
+
+    return score;
+}
+
+int BeamSearchBot::choose(GameState const & state)
+{
+    GameState * saved_game = game;
+    GameListener * saved_listener = listener;
+    listener = NULL;
+
+    compute_target_dist(state);
+
+    beam.clear();
+    beam.push_back(Node { state, -1, evaluate(state) });
+
+    FOR(level,depth) {
+        next_beam.clear();
+
+        for (auto& node : beam) {
+            // Finished games stay in the beam as they are.
+            if (node.state.is_won() || node.state.is_lost()) {
+                next_beam.push_back(node);
+                continue;
+            }
+
+            FR(action,-1,NDIRS) {
+                next_beam.push_back(Node { node.state, level == 0 ? action : node.first_action, 0 });
+                Node & child = next_beam.back();
+
+                game = &child.state;
+                move_player(action);
+                ++nodes_expanded;
+
+                child.score = evaluate(child.state);
+            }
+        }
+
+        // Stable, so that ties go to the earliest expanded node and the search is deterministic.
+        std::stable_sort(BEND(next_beam), [](Node const & a, Node const & b) {
+            return a.score > b.score;
+        });
+        if (static_cast<int>(next_beam.size()) > width) {
+            next_beam.erase(next_beam.begin() + width, next_beam.end());
+        }
+
+        std::swap(beam, next_beam);
+    }
+
+    game = saved_game;
+    listener = saved_listener;
+
+    return beam.front().first_action;
+}
+
+int BeamSearchBot::play(int max_turns)
+{
+    int turns = 0;
+    while (turns < max_turns && !game->is_won() && !game->is_lost()) {
+        move_player(choose(*game));
+        ++turns;
+    }
+    return turns;
+}
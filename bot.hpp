@@ -0,0 +1,41 @@
+#pragma once
+
+#include <vector>
+
+#include "hex_dance_dungeon.hpp"
+
+// Reference autoplayer: a beam search over cloned GameStates,
+// playing out move_player exactly as the game does.
+struct BeamSearchBot
+{
+    int depth = 4;
+    int width = 32;
+
+    // Search statistics, accumulated over all calls to choose().
+    long nodes_expanded = 0;
+
+    // Returns the action to play from state: 0..NDIRS-1, or -1 to wait.
+    int choose(GameState const & state);
+
+    // Plays the current game (the thread's `game`) until it is won, lost,
+    // or max_turns pass. Returns the number of turns played.
+    int play(int max_turns);
+
+private:
+    struct Node
+    {
+        GameState state;
+        int first_action;
+        double score;
+    };
+
+    void compute_target_dist(GameState const & state);
+    double evaluate(GameState const & state) const;
+
+    // Walking distance from each map cell to the nearest live enemy,
+    // counting doors as passable.
+    std::vector<int> target_dist;
+
+    std::vector<Node> beam;
+    std::vector<Node> next_beam;
+};
@@ -0,0 +1,63 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include "bot.hpp"
+
+// Plays every builtin map (or the ones given) to completion with the
+// reference bot, and reports win rate and search throughput.
+//
+// usage: botbench [games_per_map=10] [depth=4] [width=32] [max_turns=500] [map_path...]
+int main(int argc, char ** argv)
+{
+    int games_per_map = argc > 1 ? atoi(argv[1]) : 10;
+    int depth = argc > 2 ? atoi(argv[2]) : 4;
+    int width = argc > 3 ? atoi(argv[3]) : 32;
+    int max_turns = argc > 4 ? atoi(argv[4]) : 500;
+
+    std::vector<std::string> maps = BUILTIN_MAPS;
+    if (argc > 5) maps.assign(argv + 5, argv + argc);
+
+    printf("%-28s %6s %6s %6s %8s %10s %10s\n", "map", "games", "won", "lost", "turns", "nodes/s", "turns/s");
+
+    long all_games = 0, all_won = 0, all_nodes = 0, all_turns = 0;
+    double all_s = 0;
+
+    for (auto& map_path : maps) {
+        int won = 0, lost = 0;
+        long turns = 0;
+
+        BeamSearchBot bot;
+        bot.depth = depth;
+        bot.width = width;
+
+        auto start = std::chrono::steady_clock::now();
+        FOR(g,games_per_map) {
+            GameState state;
+            state.prng.seed(g + 1);
+            game = &state;
+            warp_to_map(map_path);
+
+            turns += bot.play(max_turns);
+            if (state.is_won()) ++won;
+            if (state.is_lost()) ++lost;
+        }
+        double elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        printf("%-28s %6d %6d %6d %8.1f %10.0f %10.1f\n",
+                map_path.c_str(), games_per_map, won, lost,
+                turns / static_cast<double>(games_per_map),
+                bot.nodes_expanded / elapsed_s, turns / elapsed_s);
+
+        all_games += games_per_map;
+        all_won += won;
+        all_nodes += bot.nodes_expanded;
+        all_turns += turns;
+        all_s += elapsed_s;
+    }
+
+    printf("total: win rate %.1f%%, %.0f nodes/s, %.1f turns/s, %.2f s\n",
+            100.0 * all_won / all_games, all_nodes / all_s, all_turns / all_s, all_s);
+
+    return 0;
+}
@@ -0,0 +1,52 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include "hex_dance_dungeon.hpp"
+
+// Measures how fast a GameState can be cloned, as a tree search would at every node.
+//
+// usage: clonebench [map_path=random] [n_clones=1000000]
+int main(int argc, char ** argv)
+{
+    std::string map_path = argc > 1 ? argv[1] : "random";
+    int n_clones = argc > 2 ? atoi(argv[2]) : 1000000;
+
+    GameState base;
+    base.prng.seed(1);
+    game = &base;
+    warp_to_map(map_path);
+
+    size_t map_bytes = base.map().tiles.size() * sizeof(Tile);
+    size_t state_bytes = sizeof(GameState)
+        + base.entities.size() * sizeof(Entity)
+        + (base.is_visible.size() + base.tile_has_been_visible.size()) * sizeof(uint64_t);
+
+    printf("map=%s cells=%d entities=%zu\n", map_path.c_str(), base.map().ncells(), base.entities.size());
+    printf("shared map: %zu bytes, per-clone state: %zu bytes\n", map_bytes, state_bytes);
+
+    long sink = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    FOR(i,n_clones) {
+        GameState copy = base;
+        sink += copy.player_s + copy.entities.size();
+    }
+    double clone_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("clone:           %.0f clones/s\n", n_clones / clone_s);
+
+    // Clone, then play one beat on the clone: the cost of expanding one search node.
+    // Actions that open doors exercise the copy-on-write map.
+    int n_steps = n_clones / 10;
+    start = std::chrono::steady_clock::now();
+    FOR(i,n_steps) {
+        GameState copy = base;
+        game = &copy;
+        move_player(i % (NDIRS+1) - 1);
+        sink += copy.player_s;
+    }
+    double step_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("clone+move:      %.0f nodes/s\n", n_steps / step_s);
+
+    return sink == 42 ? 1 : 0;
+}
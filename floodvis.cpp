@@ -7,8 +7,8 @@
 using std::make_pair;
 using std::make_tuple;
 
-static std::set<std::tuple<int,int>> mark;
-static std::vector<std::tuple<int,int>> q;
+static thread_local std::set<std::tuple<int,int>> mark;
+static thread_local std::vector<std::tuple<int,int>> q;
 
 static void enqueue(int s, int t)
 {
@@ -0,0 +1,84 @@
+#include "floorcache.hpp"
+#include "savegame.hpp"
+
+size_t FloorCache::footprint(GameState const & state)
+{
+    // The map is counted whole, even if another game shares it.
+    MapData const & map = state.map();
+    return sizeof(GameState) + sizeof(MapData)
+        + map.path.capacity()
+        + map.tiles.capacity() * sizeof(Tile)
+        + map.lights.capacity() * sizeof(LightSource)
+        + (map.room_of.capacity() + map.room_parent.capacity() + map.room_begin.capacity()
+            + map.room_end.capacity() + map.room_seen.capacity()) * sizeof(int)
+        + (state.is_visible.capacity() + state.tile_has_been_visible.capacity()) * sizeof(uint64_t)
+        + state.entities.capacity() * sizeof(Entity);
+}
+
+void FloorCache::put(GameState && state)
+{
+    drop(state.map_path());
+
+    size_t bytes = footprint(state);
+    resident.push_front({ std::move(state), bytes });
+    resident_total += bytes;
+
+    evict_over_budget();
+}
+
+bool FloorCache::take(std::string const & map_path, GameState & out)
+{
+    for (auto it = resident.begin(); it != resident.end(); ++it) {
+        if (it->state.map_path() != map_path) continue;
+        out = std::move(it->state);
+        resident_total -= it->bytes;
+        resident.erase(it);
+        return true;
+    }
+
+    auto it = evicted.find(map_path);
+    if (it == evicted.end()) return false;
+
+    GameState state;
+    bool ok = read_game(it->second.data(), it->second.size(), state);
+    evicted.erase(it);
+    if (!ok) return false;
+
+    out = std::move(state);
+    return true;
+}
+
+void FloorCache::drop(std::string const & map_path)
+{
+    for (auto it = resident.begin(); it != resident.end(); ++it) {
+        if (it->state.map_path() != map_path) continue;
+        resident_total -= it->bytes;
+        resident.erase(it);
+        break;
+    }
+    evicted.erase(map_path);
+}
+
+bool FloorCache::contains(std::string const & map_path) const
+{
+    for (auto& r : resident) {
+        if (r.state.map_path() == map_path) return true;
+    }
+    return evicted.count(map_path) > 0;
+}
+
+void FloorCache::evict_over_budget()
+{
+    // The floor just left always stays resident, whatever its size.
+    while (resident_total > budget_bytes && resident.size() > 1) {
+        Resident & lru = resident.back();
+
+        std::vector<uint8_t> & blob = evicted[lru.state.map_path()];
+        blob.clear();
+        write_game(lru.state, blob);
+        blob.shrink_to_fit();
+
+        resident_total -= lru.bytes;
+        resident.pop_back();
+    }
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "hex_dance_dungeon.hpp"
+
+// Floors the player has left, kept with their entities and explored tiles so
+// going back is instant and picks up where they were.
+//
+// The most recently left floors stay resident as live GameStates, up to
+// budget_bytes between them. Older ones are evicted to their compact
+// write_game encoding, which is decoded again when they're revisited.
+// Floors are keyed by map path.
+struct FloorCache
+{
+    explicit FloorCache(size_t budget_bytes = 64 << 20) : budget_bytes(budget_bytes) {}
+
+    size_t budget_bytes;
+
+    // Stores the floor being left, replacing any earlier copy of it.
+    void put(GameState && state);
+
+    // Moves the stored floor for map_path into out. Returns false, leaving out
+    // alone, if there isn't one.
+    bool take(std::string const & map_path, GameState & out);
+
+    // Forgets the floor for map_path, e.g. when it's restarted.
+    void drop(std::string const & map_path);
+
+    bool contains(std::string const & map_path) const;
+
+    size_t resident_bytes() const { return resident_total; }
+    int resident_count() const { return static_cast<int>(resident.size()); }
+    int evicted_count() const { return static_cast<int>(evicted.size()); }
+
+    // Roughly how much memory a game holds on to.
+    static size_t footprint(GameState const & state);
+
+private:
+    struct Resident
+    {
+        GameState state;
+        size_t bytes;
+    };
+
+    void evict_over_budget();
+
+    // Most recently used first.
+    std::list<Resident> resident;
+    size_t resident_total = 0;
+
+    std::map<std::string, std::vector<uint8_t>> evicted;
+};
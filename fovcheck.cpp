@@ -0,0 +1,475 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <map>
+
+// https://github.com/nlohmann/json
+#include "nlohmann/json.hpp"
+
+#include "hex_dance_dungeon.hpp"
+
+using nlohmann::json;
+using std::make_pair;
+using std::make_tuple;
+
+// Differential checks for the visibility engines on random hex maps:
+// - compute_visibility and compute_visibility_reference against cast_rays,
+//   a brute-force ray caster, from a few floor tiles of each small map
+// - compute_visibility against compute_visibility_reference, from every floor tile
+// - compute_visibility_within against compute_visibility_reference cut down
+//   to the radius, from every floor tile
+// - the room lists (compute_visibility_plus) against compute_visibility_flood,
+//   from some floor tiles of each map, as the flood is slow
+// - on maps of one convex room, where sight and flood must agree,
+//   compute_visibility against compute_visibility_flood
+// - Entity::can_see_player and seeing_player against a flood from each
+//   enemy's tile, with the player and some enemies on doors, where the room
+//   lists give way to the flood
+//
+// The first failure of each check is shrunk to a small map and written to
+// fovcheck_<check>.json, with the player on the failing tile. Each engine is
+// also timed; the run fails if an engine is more than max_slowdown times
+// slower than the one it stands in for.
+//
+// usage: fovcheck [n_maps=200] [seed=1] [max_slowdown=1.0]
+
+// Floor tiles per map to cast rays and flood from, and the largest map to cast rays on.
+int const RAY_ORIGINS = 4;
+int const FLOOD_ORIGINS = 32;
+int const RAY_MAX_RADIUS = 12;
+// For compute_visibility_within.
+int const SIGHT_RADIUS = 5;
+// Enemies per map for the sight symmetry check.
+int const SYMMETRY_ENEMIES = 8;
+
+// A hex of the given radius, with walls and doors scattered over the floor.
+GameState random_fov_map(std::minstd_rand & rng, int radius, double wall_prob)
+{
+    GameState state;
+
+    auto map = std::make_shared<MapData>();
+    map->min_s = -radius;
+    map->min_t = -radius;
+    map->n_s = 2*radius + 1;
+    map->n_t = 2*radius + 1;
+    map->tiles.resize(map->ncells());
+    FOR(i,map->ncells()) {
+        int s = map->s_of(i), t = map->t_of(i);
+        if (hex_dist(0, 0, s, t) > radius) continue;
+
+        Tile & tile = map->tiles[i];
+        double r = std::uniform_real_distribution<double>(0, 1)(rng);
+        if (r < wall_prob * 0.8) {
+            tile.type = TileType::wall;
+        } else if (r < wall_prob) {
+            tile.type = TileType::door;
+            tile.rotation = rng() % 3;
+        } else {
+            tile.type = TileType::floor;
+        }
+    }
+    segment_rooms(*map);
+    state.shared_map = map;
+
+    resize_bits(state.is_visible, map->ncells());
+    resize_bits(state.tile_has_been_visible, map->ncells());
+    return state;
+}
+
+// One walled room, cut like MapBuilder::hex_room cuts them.
+GameState convex_room_map(std::minstd_rand & rng)
+{
+    int s_len = 3 + rng() % 12, t_len = 3 + rng() % 12;
+    int trim_min = rng() % std::min(s_len, t_len), trim_max = rng() % std::min(s_len, t_len);
+
+    GameState state;
+    auto map = std::make_shared<MapData>();
+    map->n_s = s_len + 1;
+    map->n_t = t_len + 1;
+    map->tiles.resize(map->ncells());
+    FOR(i,map->ncells()) {
+        int s = map->s_of(i), t = map->t_of(i);
+        int slack_min = s + t - trim_min;
+        int slack_max = (s_len - s + t_len - t) - trim_max;
+        if (slack_min < 0 || slack_max < 0) continue;
+
+        bool inside = 0 < s && s < s_len && 0 < t && t < t_len && slack_min > 0 && slack_max > 0;
+        map->tiles[i].type = inside ? TileType::floor : TileType::wall;
+    }
+    segment_rooms(*map);
+    state.shared_map = map;
+
+    resize_bits(state.is_visible, map->ncells());
+    resize_bits(state.tile_has_been_visible, map->ncells());
+    return state;
+}
+
+// Brute-force ray casting
+//
+// Shadowcasting sees a tile if any slope it spans is lit, and its answers
+// only change at the slopes where some tile starts or ends. So casting one
+// ray between each pair of neighbouring such slopes, and walking it out row
+// by row until it hits something opaque, sees exactly what it should. Slopes
+// are fractions dy/dx in a sextant, as in vis.cpp.
+
+typedef std::pair<long,long> Fraction;
+
+static long gcd(long a, long b)
+{
+    while (b) {
+        long r = a % b;
+        a = b;
+        b = r;
+    }
+    return a;
+}
+
+// Slopes between each pair of neighbouring tile edges out to row max_x.
+static std::vector<Fraction> const & ray_slopes(int max_x)
+{
+    static std::map<int, std::vector<Fraction>> cache;
+    auto found = cache.find(max_x);
+    if (found != cache.end()) return found->second;
+
+    auto less = [](Fraction a, Fraction b) { return a.first * b.second < b.first * a.second; };
+    std::vector<Fraction> edges = { {0, 1}, {1, 1} };
+    FR(x,2,max_x+1) {
+        for (int yc = positive_mod(-x, 3); yc <= x; yc += 3) {
+            for (long dy : { yc-1, yc+1 }) {
+                if (dy <= 0 || dy >= x) continue;
+                long g = gcd(dy, x);
+                edges.push_back(make_pair(dy / g, x / g));
+            }
+        }
+    }
+    std::sort(BEND(edges), less);
+    edges.erase(std::unique(BEND(edges)), edges.end());
+
+    std::vector<Fraction> & rays = cache[max_x];
+    FOR(k,static_cast<int>(edges.size()) - 1) {
+        auto [ a, b ] = edges[k];
+        auto [ c, d ] = edges[k+1];
+        rays.push_back(make_pair(a*d + c*b, 2*b*d));
+    }
+    return rays;
+}
+
+void cast_rays(int origin_s, int origin_t)
+{
+    MapData const & map = game->map();
+
+    // Rays stop at the edge of the map's box at the latest, and a tile at
+    // distance d is at most row 2d.
+    int max_dist = 0;
+    for (int s : { map.min_s, map.min_s + map.n_s - 1 }) {
+        for (int t : { map.min_t, map.min_t + map.n_t - 1 }) {
+            max_dist = std::max(max_dist, hex_dist(origin_s, origin_t, s, t));
+        }
+    }
+    int max_x = 2 * (max_dist + 1);
+
+    mark_tile_visible(origin_s, origin_t);
+    FOR(rot,6) {
+        for (auto [ dy, dx ] : ray_slopes(max_x)) {
+            FR(x,2,max_x+1) {
+                // The tile yc of row x spans slopes ((yc-1)/x, (yc+1)/x), with yc = -x mod 3.
+                // At most one contains the ray; it may pass between two.
+                long y = dy * x;
+                int yc = y / dx - 1;
+                while (positive_mod(yc + x, 3) != 0) ++yc;
+                if (!((yc-1)*dx < y && y < (yc+1)*dx)) continue;
+
+                int s = (2*x-yc)/3;
+                int t = (2*yc-x)/3;
+                int p = -s-t;
+                FOR(r,rot) std::tie(s,t,p) = make_tuple(-p,-s,-t);
+
+                mark_tile_visible(origin_s + s, origin_t + t);
+                if (is_tile_opaque(origin_s + s, origin_t + t)) break;
+            }
+        }
+    }
+}
+
+// Engines
+
+struct Engine
+{
+    char const * name;
+    std::function<void(int s, int t)> run;
+    double seconds = 0;
+    long queries = 0;
+
+    double ns_per_query() const { return queries ? seconds / queries * 1e9 : 0; }
+};
+
+static Engine table_engine { "table", compute_visibility };
+static Engine reference_engine { "reference", compute_visibility_reference };
+static Engine rays_engine { "rays", cast_rays };
+static Engine within_engine { "within", [](int s, int t) {
+    compute_visibility_within(s, t, SIGHT_RADIUS);
+} };
+static Engine clipped_engine { "clipped", [](int s, int t) {
+    compute_visibility_reference(s, t);
+    MapData const & map = game->map();
+    FOR(i,map.ncells()) {
+        if (hex_dist(s, t, map.s_of(i), map.t_of(i)) > SIGHT_RADIUS) {
+            game->is_visible[i >> 6] &= ~(uint64_t(1) << (i & 63));
+        }
+    }
+} };
+static Engine flood_engine { "flood", compute_visibility_flood };
+static Engine rooms_engine { "rooms", [](int s, int t) {
+    game->player_s = s;
+    game->player_t = t;
+    compute_visibility_plus();
+} };
+
+// Runs the engine from each origin cell of the current game; one batch per
+// engine, so neither gets the other's warm caches.
+static std::vector<CellBits> run_all(Engine & engine, std::vector<int> const & origins)
+{
+    MapData const & map = game->map();
+    std::vector<CellBits> seen;
+    auto start = std::chrono::steady_clock::now();
+    for (int i : origins) {
+        std::fill(BEND(game->is_visible), 0);
+        engine.run(map.s_of(i), map.t_of(i));
+        seen.push_back(game->is_visible);
+    }
+    engine.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    engine.queries += origins.size();
+    return seen;
+}
+
+// Checks
+
+enum class MapKind { scattered, convex };
+
+struct Check
+{
+    char const * name;
+    Engine * a;
+    Engine * b;
+    MapKind kind;
+    int origins_per_map = 0;  // 0 for all of them
+    int max_radius = 1000;
+
+    long queries = 0;
+    long failures = 0;
+};
+
+static Check checks[] = {
+    { "table_rays", &table_engine, &rays_engine, MapKind::scattered, RAY_ORIGINS, RAY_MAX_RADIUS },
+    { "reference_rays", &reference_engine, &rays_engine, MapKind::scattered, RAY_ORIGINS, RAY_MAX_RADIUS },
+    { "table_reference", &table_engine, &reference_engine, MapKind::scattered },
+    { "within_clipped", &within_engine, &clipped_engine, MapKind::scattered },
+    { "rooms_flood", &rooms_engine, &flood_engine, MapKind::scattered, FLOOD_ORIGINS },
+    { "convex_table_flood", &table_engine, &flood_engine, MapKind::convex },
+};
+
+// Each optimised engine, and the one it has to beat.
+static std::pair<Engine *, Engine *> const gates[] = {
+    { &table_engine, &reference_engine },
+    { &rooms_engine, &flood_engine },
+};
+
+// Places the player and a few enemies on floors and doors of the current
+// game, then floods from each enemy and checks that it lights the player
+// exactly when can_see_player says so, and that seeing_player lists the same
+// enemies. Returns the number of mismatches; counts queries.
+static int check_symmetry(std::minstd_rand & rng, std::vector<int> const & floors, long & queries)
+{
+    MapData const & map = game->map();
+    std::vector<int> doors;
+    FOR(i,map.ncells()) {
+        if (map.tiles[i].type == TileType::door) doors.push_back(i);
+    }
+    auto pick = [&](bool door) { return door ? doors[rng() % doors.size()] : floors[rng() % floors.size()]; };
+
+    int at = pick(!doors.empty() && rng() % 2);
+    game->player_s = map.s_of(at);
+    game->player_t = map.t_of(at);
+    game->entities.clear();
+    FOR(k,SYMMETRY_ENEMIES) {
+        int i = pick(!doors.empty() && (k == 0 || rng() % 4 == 0));
+        Entity e;
+        e.s = map.s_of(i);
+        e.t = map.t_of(i);
+        e.type = EntityType::bat_blue;
+        e.init();
+        game->entities.push_back(e);
+    }
+    compute_visibility_plus();
+    CellBits players = game->is_visible;
+
+    int failures = 0;
+    std::vector<Entity*> expected;
+    for (Entity & e : game->entities) {
+        game->is_visible = players;
+        bool sees = e.can_see_player();
+        if (sees) expected.push_back(&e);
+
+        std::fill(BEND(game->is_visible), 0);
+        compute_visibility_flood(e.s, e.t);
+        ++queries;
+        if (game->visible(game->player_s, game->player_t) == sees) continue;
+
+        if (failures++ == 0) {
+            printf("sight_symmetry: enemy at (%d,%d) %s the player at (%d,%d), but the flood says otherwise\n",
+                    e.s, e.t, sees ? "sees" : "does not see", game->player_s, game->player_t);
+        }
+    }
+
+    game->is_visible = players;
+    std::vector<Entity*> listed;
+    Entity::seeing_player(listed);
+    ++queries;
+    if (listed != expected) {
+        if (failures++ == 0) printf("sight_symmetry: seeing_player disagrees with can_see_player\n");
+    }
+    return failures;
+}
+
+static bool agree(Check & check, int origin)
+{
+    // On copies of the engines, so shrinking stays out of their timings.
+    Engine a = *check.a, b = *check.b;
+    std::vector<int> one = { origin };
+    return run_all(a, one) == run_all(b, one);
+}
+
+// Greedily empties or floors tiles while the check still fails from origin,
+// until no single tile can go.
+static void minimise(Check & check, GameState & state, int origin)
+{
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        FOR(i,state.map().ncells()) {
+            Tile old = state.map().tiles[i];
+            if (i == origin || old.type == TileType::none) continue;
+
+            for (TileType type : { TileType::none, TileType::floor }) {
+                if (type == old.type) continue;
+
+                MapData & map = state.map_for_write();
+                map.tiles[i] = Tile();
+                map.tiles[i].type = type;
+                segment_rooms(map);
+                if (!agree(check, origin)) {
+                    changed = true;
+                    break;
+                }
+                map.tiles[i] = old;
+                segment_rooms(map);
+            }
+        }
+    }
+}
+
+// In the same format as the maps in data/, so it can be loaded and looked at.
+static void write_map(GameState const & state, int origin, std::string const & path)
+{
+    MapData const & map = state.map();
+    json tiles = json::array();
+    FOR(i,map.ncells()) {
+        Tile const & tile = map.tiles[i];
+        if (tile.type == TileType::none) continue;
+        char const * type = tile.type == TileType::floor ? "floor" : tile.type == TileType::wall ? "wall" : "door";
+        tiles.push_back({ { "s", map.s_of(i) }, { "t", map.t_of(i) }, { "type", type }, { "rotation", tile.rotation } });
+    }
+
+    json j;
+    j["player_s"] = map.s_of(origin);
+    j["player_t"] = map.t_of(origin);
+    j["tiles"] = tiles;
+    j["entities"] = json::array();
+
+    std::ofstream o(path);
+    o << j.dump() << "\n";
+}
+
+int main(int argc, char ** argv)
+{
+    int n_maps = argc > 1 ? atoi(argv[1]) : 200;
+    unsigned seed = argc > 2 ? atoi(argv[2]) : 1;
+    double max_slowdown = argc > 3 ? atof(argv[3]) : 1.0;
+
+    std::minstd_rand rng(seed);
+    long symmetry_queries = 0, symmetry_failures = 0;
+
+    FOR(m,n_maps) {
+        // Mostly scattered walls; now and then one room, or a map big enough
+        // for sight to run past vis.cpp's table.
+        MapKind kind = m % 4 == 3 ? MapKind::convex : MapKind::scattered;
+        int radius = m % 10 == 9 ? 30 + rng() % 10 : 4 + rng() % 12;
+        double wall_prob = std::uniform_real_distribution<double>(0, 0.4)(rng);
+        GameState state = kind == MapKind::convex ? convex_room_map(rng) : random_fov_map(rng, radius, wall_prob);
+        game = &state;
+
+        MapData const & map = state.map();
+        std::vector<int> origins;
+        FOR(i,map.ncells()) {
+            if (map.tiles[i].type == TileType::floor) origins.push_back(i);
+        }
+        if (origins.empty()) continue;
+
+        for (Check & check : checks) {
+            if (check.kind != kind || radius > check.max_radius) continue;
+
+            std::vector<int> from = origins;
+            if (check.origins_per_map) {
+                from.clear();
+                FOR(k,check.origins_per_map) from.push_back(origins[rng() % origins.size()]);
+            }
+            std::vector<CellBits> by_a = run_all(*check.a, from);
+            std::vector<CellBits> by_b = run_all(*check.b, from);
+
+            FOR(k,static_cast<int>(from.size())) {
+                ++check.queries;
+                if (by_a[k] == by_b[k]) continue;
+
+                if (check.failures++ == 0) {
+                    GameState small = state;
+                    game = &small;
+                    minimise(check, small, from[k]);
+                    std::string path = std::string("fovcheck_") + check.name + ".json";
+                    write_map(small, from[k], path);
+                    game = &state;
+
+                    printf("%s: mismatch on map %d from (%d,%d); shrunk to %s\n", check.name, m,
+                            map.s_of(from[k]), map.t_of(from[k]), path.c_str());
+                }
+            }
+        }
+
+        if (kind == MapKind::scattered) {
+            int failures = check_symmetry(rng, origins, symmetry_queries);
+            if (failures && symmetry_failures == 0) printf("sight_symmetry: on map %d\n", m);
+            symmetry_failures += failures;
+        }
+    }
+
+    bool ok = true;
+    for (Check & check : checks) {
+        printf("%-20s %8ld queries %6ld mismatches\n", check.name, check.queries, check.failures);
+        if (check.failures) ok = false;
+    }
+    printf("%-20s %8ld queries %6ld mismatches\n", "sight_symmetry", symmetry_queries, symmetry_failures);
+    if (symmetry_failures) ok = false;
+    for (Engine * engine : { &table_engine, &reference_engine, &rays_engine, &within_engine, &clipped_engine, &flood_engine, &rooms_engine }) {
+        printf("%-10s %10.0f ns/query\n", engine->name, engine->ns_per_query());
+    }
+    for (auto [ fast, slow ] : gates) {
+        double slowdown = fast->ns_per_query() / slow->ns_per_query();
+        printf("%s vs %s: %.2fx the time%s\n", fast->name, slow->name, slowdown,
+                slowdown > max_slowdown ? ", too slow" : "");
+        if (slowdown > max_slowdown) ok = false;
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,1099 @@
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include <fstream>
+
+// https://github.com/nlohmann/json
+#include "nlohmann/json.hpp"
+
+#include "hex_dance_dungeon.hpp"
+#include "telemetry.hpp"
+
+using nlohmann::json;
+using std::make_pair;
+using std::make_tuple;
+
+thread_local GameState * game = NULL;
+thread_local GameListener * listener = NULL;
+
+// Many of the hex grid routines are informed by
+// https://www.redblobgames.com/grids/hexagons
+int positive_mod(int x, int m)
+{
+    return (x % m + m) % m;
+}
+
+// Means: how many 60-degree increments separate these two directions.
+int dir_deviation(int d1, int d2)
+{
+    return std::min(positive_mod(d2-d1, NDIRS), positive_mod(d1-d2, NDIRS));
+}
+
+int hex_dist(int s1, int t1, int s2, int t2)
+{
+    int p1 = -s1-t1;
+    int p2 = -s2-t2;
+
+    return (abs(s1-s2) + abs(t1-t2) + abs(p1-p2))/2;
+}
+
+int hex_dist_l2sq(int s1, int t1, int s2, int t2)
+{
+    // This formula assumes that the center-to-center distance of adjacent hexes is 1.
+    int ds = s2-s1, dt = t2-t1;
+    return ds*ds + dt*dt + ds*dt;
+}
+
+std::tuple<int, int> hex_to_pixel(int s, int t)
+{
+    int p = -s-t;
+
+    return make_tuple(
+            ORIGIN_X_PX + HORIZONTAL_HALF_PERIOD_PX * (s - p),
+            ORIGIN_Y_PX - VERTICAL_HALF_PERIOD_PX * t);
+}
+
+void mark_tile_visible(int s, int t)
+{
+    int i = game->map().index(s, t);
+    if (i >= 0 && game->map().tiles[i].type != TileType::none) {
+        set_bit(game->is_visible, i);
+    }
+}
+
+bool is_tile_opaque(int s, int t)
+{
+    Tile const * tile = game->map().at(s, t);
+    if (!tile) return true;
+    return tile->type != TileType::floor;
+}
+
+bool is_tile_blocking(int s, int t)
+{
+    Tile const * tile = game->map().at(s, t);
+    if (!tile) return false;
+    return tile->type != TileType::floor;
+}
+
+// Appends the cells that room cell i and its neighbours make visible.
+static void add_seen(MapData const & map, int i, std::vector<int> & seen)
+{
+    seen.push_back(i);
+    int s = map.s_of(i), t = map.t_of(i);
+    FOR(d,NDIRS) {
+        int j = map.index(s + DIR_DS[d], t + DIR_DT[d]);
+        if (j < 0) continue;
+        TileType type = map.tiles[j].type;
+        if (type != TileType::none && type != TileType::floor) seen.push_back(j);
+    }
+}
+
+// Sorts room_seen from begin on and drops repeats: a wall seen from several
+// cells of a room is listed once.
+static void dedup_seen(std::vector<int> & seen, size_t begin)
+{
+    std::sort(seen.begin() + begin, seen.end());
+    seen.erase(std::unique(seen.begin() + begin, seen.end()), seen.end());
+}
+
+// Copies out only the lists of root rooms, dropping the ones merged away.
+static void compact_rooms(MapData & map)
+{
+    std::vector<int> seen;
+    seen.reserve(map.room_seen.size() - map.room_seen_dead);
+    FOR(r,static_cast<int>(map.room_parent.size())) {
+        if (map.room_parent[r] != r) continue;
+        int begin = seen.size();
+        seen.insert(seen.end(), map.room_seen.begin() + map.room_begin[r], map.room_seen.begin() + map.room_end[r]);
+        map.room_begin[r] = begin;
+        map.room_end[r] = seen.size();
+    }
+    map.room_seen.swap(seen);
+    map.room_seen_dead = 0;
+}
+
+void segment_rooms(MapData & map)
+{
+    map.room_of.assign(map.ncells(), -1);
+    map.room_parent.clear();
+    map.room_begin.clear();
+    map.room_end.clear();
+    map.room_seen.clear();
+    map.room_seen_dead = 0;
+
+    std::vector<int> stack;
+    FOR(start,map.ncells()) {
+        if (map.tiles[start].type != TileType::floor || map.room_of[start] != -1) continue;
+
+        int room = map.room_parent.size();
+        map.room_parent.push_back(room);
+        map.room_begin.push_back(map.room_seen.size());
+
+        map.room_of[start] = room;
+        stack.push_back(start);
+        while (!stack.empty()) {
+            int i = stack.back();
+            stack.pop_back();
+            add_seen(map, i, map.room_seen);
+
+            int s = map.s_of(i), t = map.t_of(i);
+            FOR(d,NDIRS) {
+                int j = map.index(s + DIR_DS[d], t + DIR_DT[d]);
+                if (j < 0 || map.room_of[j] != -1 || map.tiles[j].type != TileType::floor) continue;
+                map.room_of[j] = room;
+                stack.push_back(j);
+            }
+        }
+
+        dedup_seen(map.room_seen, map.room_begin.back());
+        map.room_end.push_back(map.room_seen.size());
+    }
+}
+
+void open_door(MapData & map, int i)
+{
+    Tile new_tile;
+    new_tile.type = TileType::floor;
+    map.tiles[i] = new_tile;
+
+    // The door becomes a room of its own, then joins the rooms around it.
+    int room = map.room_parent.size();
+    map.room_parent.push_back(room);
+    map.room_of[i] = room;
+
+    std::vector<int> seen;
+    add_seen(map, i, seen);
+
+    int s = map.s_of(i), t = map.t_of(i);
+    FOR(d,NDIRS) {
+        int j = map.index(s + DIR_DS[d], t + DIR_DT[d]);
+        if (j < 0 || map.room_of[j] == -1) continue;
+
+        int other = map.room_root(map.room_of[j]);
+        if (other == room) continue;
+        map.room_parent[other] = room;
+        seen.insert(seen.end(), map.room_seen.begin() + map.room_begin[other], map.room_seen.begin() + map.room_end[other]);
+        map.room_seen_dead += map.room_end[other] - map.room_begin[other];
+    }
+    dedup_seen(seen, 0);
+
+    // The merged list goes on the end, and the old ones are dead. Compact once
+    // they outnumber the live ones, so that costs O(1) per cell merged.
+    map.room_begin.push_back(map.room_seen.size());
+    map.room_seen.insert(map.room_seen.end(), BEND(seen));
+    map.room_end.push_back(map.room_seen.size());
+    if (2 * map.room_seen_dead > map.room_seen.size()) compact_rooms(map);
+}
+
+void rooms_around(MapData const & map, int i, std::vector<SavedRoom> & out)
+{
+    out.clear();
+    int s = map.s_of(i), t = map.t_of(i);
+    FOR(d,NDIRS) {
+        int j = map.index(s + DIR_DS[d], t + DIR_DT[d]);
+        if (j < 0 || map.room_of[j] == -1) continue;
+
+        int root = map.room_root(map.room_of[j]);
+        if (std::any_of(BEND(out), [&](SavedRoom const & r) { return r.root == root; })) continue;
+        out.push_back({ root, std::vector<int>(map.room_seen.begin() + map.room_begin[root], map.room_seen.begin() + map.room_end[root]) });
+    }
+}
+
+void close_door(MapData & map, int i, Tile door, std::vector<SavedRoom> const & rooms)
+{
+    map.tiles[i] = door;
+
+    // The door is the newest room, and the root of the ones it merged.
+    int room = map.room_of[i];
+    assert(room == static_cast<int>(map.room_parent.size()) - 1);
+    map.room_of[i] = -1;
+    map.room_seen_dead += map.room_end[room] - map.room_begin[room];
+    map.room_parent.pop_back();
+    map.room_begin.pop_back();
+    map.room_end.pop_back();
+
+    // Their old lists may have been compacted away, so they go on the end again.
+    for (auto& r : rooms) {
+        map.room_parent[r.root] = r.root;
+        map.room_begin[r.root] = map.room_seen.size();
+        map.room_seen.insert(map.room_seen.end(), BEND(r.seen));
+        map.room_end[r.root] = map.room_seen.size();
+    }
+    if (2 * map.room_seen_dead > map.room_seen.size()) compact_rooms(map);
+}
+
+void compute_visibility_plus()
+{
+    std::fill(BEND(game->is_visible), 0);
+
+    MapData const & map = game->map();
+    int i = map.index(game->player_s, game->player_t);
+    if (i >= 0 && map.room_of[i] != -1) {
+        int room = map.room_root(map.room_of[i]);
+        FR(k,map.room_begin[room],map.room_end[room]) {
+            set_bit(game->is_visible, map.room_seen[k]);
+        }
+    } else {
+        compute_visibility_flood(game->player_s, game->player_t);
+    }
+    FOR(w,static_cast<int>(game->is_visible.size())) {
+        uint64_t explored = game->tile_has_been_visible[w] | game->is_visible[w];
+        if (explored == game->tile_has_been_visible[w]) continue;
+        if (listener) listener->explored_changing(w);
+        game->tile_has_been_visible[w] = explored;
+    }
+}
+
+void player_be_hit(Entity const & by)
+{
+    if (telemetry) telemetry->push(TelemetryType::player_hit, static_cast<int>(by.type), by.s, by.t);
+    game->player.health -= 1;
+    if (listener) listener->player_hit(by);
+}
+
+bool Entity::is_inactive()
+{
+    return is_dead || !has_been_visible;
+}
+
+bool Entity::can_see_player()
+{
+    if (is_dead) return false;
+    MapData const & map = game->map();
+    int i = map.index(s, t), p = map.index(game->player_s, game->player_t);
+    if (i < 0 || p < 0) return false;
+    // Between two floor cells sight is symmetric: a room sees all of itself.
+    if (map.room_of[i] != -1 && map.room_of[p] != -1) return test_bit(game->is_visible, i);
+    // Off the floor, as on a door, a cell sees only itself, while a room
+    // sees the doors and walls around it.
+    if (map.room_of[i] == -1) return i == p;
+    int room = map.room_root(map.room_of[i]);
+    return std::binary_search(map.room_seen.begin() + map.room_begin[room], map.room_seen.begin() + map.room_end[room], p);
+}
+
+void Entity::move()
+{
+    if (is_inactive()) return;
+    if (listener) listener->entity_changing(*this);
+
+    int player_s = game->player_s, player_t = game->player_t;
+    int player_prev_s = game->player_prev_s, player_prev_t = game->player_prev_t;
+
+    if (type == EntityType::ghost) {
+        int player_dist = hex_dist_l2sq(s, t, player_s, player_t);
+        int player_prev_dist = hex_dist_l2sq(s, t, player_prev_s, player_prev_t);
+
+        if (player_dist > player_prev_dist) {
+            hiding = false;
+        } else if (player_dist < player_prev_dist) {
+            hiding = true;
+        }
+
+        if (hiding) return;
+    }
+
+    if (moveCooldown > 0) {
+        --moveCooldown;
+        return;
+    }
+
+    int move_dir = -1;
+
+    if (type == EntityType::bat_blue || type == EntityType::bat_red || type == EntityType::slime_blue) {
+        move_dir = prep_dir;
+        prep_dir = -1;
+    } else if (type == EntityType::skeleton_white || type == EntityType::ghost) {
+        // If we can't get closer to the player's current or previous position, prefer standing still.
+        auto best_key = make_tuple(
+                hex_dist(s, t, player_s, player_t),
+                hex_dist(s, t, player_prev_s, player_prev_t),
+                0);
+
+        // If all our desired moves are blocked, then instead of standing still,
+        // bump whichever tile we'd most like to be empty.
+        auto bump_key = best_key;
+        int bump_dir = -1;
+
+        FOR(d,NDIRS) {
+            int new_s = s + DIR_DS[d];
+            int new_t = t + DIR_DT[d];
+
+            // Always hit player when possible
+            if (player_s == new_s && player_t == new_t) {
+                move_dir = d;
+                break;
+            }
+
+            auto cur_key = make_tuple(
+                    hex_dist(new_s, new_t, player_s, player_t),
+                    hex_dist(new_s, new_t, player_prev_s, player_prev_t),
+                    dir_deviation(momentum_dir, d));
+
+            if (cur_key < bump_key) {
+                bump_key = cur_key;
+                bump_dir = d;
+            }
+
+            if (is_tile_blocking(new_s, new_t) || Entity::is_at(new_s, new_t)) continue;
+
+            if (cur_key < best_key) {
+                best_key = cur_key;
+                move_dir = d;
+            }
+        }
+
+        if (move_dir == -1) move_dir = bump_dir;
+    }
+
+    if (move_dir == -1) return;
+
+    momentum_dir = move_dir;
+
+    int target_s = s + DIR_DS[move_dir];
+    int target_t = t + DIR_DT[move_dir];
+
+    bool moveFailed = false;
+
+    if (is_tile_blocking(target_s, target_t) || Entity::is_at(target_s, target_t)) {
+        last_motion = TweenType::bump;
+        motion_s = target_s;
+        motion_t = target_t;
+        moveFailed = true;
+    } else if (player_s == target_s && player_t == target_t) {
+        last_motion = TweenType::bump;
+        motion_s = target_s;
+        motion_t = target_t;
+        player_be_hit(*this);
+    } else {
+        last_motion = TweenType::move;
+        motion_s = s;
+        motion_t = t;
+        s = target_s;
+        t = target_t;
+    }
+
+    if (!moveFailed) {
+        moveCooldown = moveCooldownMax;
+    }
+}
+
+void Entity::think()
+{
+    if (is_inactive()) return;
+    if (listener) listener->entity_changing(*this);
+
+    if (thinkCooldown > 0) {
+        --thinkCooldown;
+        return;
+    }
+    thinkCooldown = thinkCooldownMax;
+
+    if (type == EntityType::bat_blue || type == EntityType::bat_red) {
+        int num_open_dirs = 0;
+        int open_dirs[NDIRS];
+
+        FOR(d,NDIRS) {
+            int target_s = s + DIR_DS[d];
+            int target_t = t + DIR_DT[d];
+
+            if (!is_tile_blocking(target_s, target_t)) {
+                open_dirs[num_open_dirs++] = d;
+            }
+        }
+
+        if (num_open_dirs == 0) return;
+
+        int i = game->prng() % num_open_dirs;
+        prep_dir = open_dirs[i];
+    } else if (type == EntityType::slime_blue) {
+        prep_dir = 3 * parity;
+        parity = (parity+1)%2;
+    }
+}
+
+bool Entity::is_hittable()
+{
+    if (type == EntityType::ghost && hiding) return false;
+    return true;
+}
+
+void Entity::be_hit()
+{
+    if (listener) listener->entity_changing(*this);
+    is_dead = true;
+    if (telemetry) telemetry->push(TelemetryType::enemy_killed, static_cast<int>(type), s, t);
+    if (listener) listener->enemy_killed(*this);
+}
+
+void Entity::init()
+{
+    switch (type) {
+    case EntityType::bat_blue: {
+        thinkCooldownMax = 1;
+        break;
+    }
+    case EntityType::bat_red: {
+        break;
+    }
+    case EntityType::slime_blue: {
+        thinkCooldownMax = 1;
+        break;
+    }
+    case EntityType::ghost: {
+        break;
+    }
+    case EntityType::skeleton_white: {
+        moveCooldownMax = 1;
+        frameTelegraph = 1;
+        break;
+    }
+    default: assert(!"Unrecognized entity type");
+    }
+
+    // Reasoning behind these values:
+    // 0. On the beat an enemy becomes visible, it shouldn't move.
+    // 1. On the next beat, it _still_ shouldn't move, but it's OK if it preps.
+    // 2. The beat after that, move is OK.
+    // This way the player has 2 beats to react to newly-visible enemies.
+    //
+    // If thinkCooldown=thinkCooldownMax, then blue bat wouldn't move until beat 3,
+    // which feels weird.
+    moveCooldown = moveCooldownMax;
+    thinkCooldown = 0;
+
+    last_motion = TweenType::none;
+}
+
+std::tuple<int, int, int>
+Entity::priority_key()
+{
+    return make_tuple(
+        hex_dist_l2sq(s, t, game->player_s, game->player_t),
+        t,
+        s);
+}
+
+EntityType Entity::deserialize_type(std::string const & type)
+{
+    if (type == "enemy_bat_blue") return EntityType::bat_blue;
+    if (type == "enemy_bat_red") return EntityType::bat_red;
+    if (type == "enemy_slime_blue") return EntityType::slime_blue;
+    if (type == "enemy_ghost") return EntityType::ghost;
+    if (type == "enemy_skeleton_white") return EntityType::skeleton_white;
+    assert(!"Unrecognized entity type");
+    return EntityType::none;
+}
+
+const char * Entity::serialize_type(EntityType type)
+{
+    switch (type) {
+    case EntityType::bat_blue: return "enemy_bat_blue";
+    case EntityType::bat_red: return "enemy_bat_red";
+    case EntityType::slime_blue: return "enemy_slime_blue";
+    case EntityType::ghost: return "enemy_ghost";
+    case EntityType::skeleton_white: return "enemy_skeleton_white";
+    default: assert(!"Unrecognized entity type");
+    }
+    return NULL;
+}
+
+thread_local std::vector<Entity*> Entity::prioritized;
+
+void Entity::move_enemies()
+{
+    prioritized.clear();
+    for (auto& e : game->entities) {
+        if (e.last_motion != TweenType::none) {
+            if (listener) listener->entity_changing(e);
+            e.last_motion = TweenType::none;
+        }
+        prioritized.push_back(&e);
+    }
+    sort(BEND(prioritized), [](Entity * e1, Entity * e2) {
+        return e1->priority_key() < e2->priority_key();
+    });
+
+    for (auto& e : prioritized) {
+        e->move();
+    }
+    for (auto& e : prioritized) {
+        e->think();
+    }
+
+    // Wake visible enemies AFTER movement,
+    // so that they don't start moving instantly when seen.
+    wake_visible();
+}
+
+void Entity::wake_visible()
+{
+    for (auto& e : game->entities) {
+        if (!e.has_been_visible && e.can_see_player()) {
+            if (listener) listener->entity_changing(e);
+            e.has_been_visible = true;
+            if (telemetry) telemetry->push(TelemetryType::enemy_woke, static_cast<int>(e.type), e.s, e.t);
+        }
+    }
+}
+
+void Entity::seeing_player(std::vector<Entity*> & out)
+{
+    out.clear();
+    for (auto& e : game->entities) {
+        if (e.can_see_player()) out.push_back(&e);
+    }
+}
+
+Entity * Entity::get_at(int s, int t)
+{
+    for (auto& e : game->entities) {
+        if (!e.is_dead && e.s == s && e.t == t) {
+            return &e;
+        }
+    }
+    return NULL;
+}
+
+bool Entity::is_at(int s, int t)
+{
+    return get_at(s, t) != NULL;
+}
+
+bool player_act(int dir)
+{
+    game->player_prev_s = game->player_s;
+    game->player_prev_t = game->player_t;
+
+    int ds = 0, dt = 0;
+    if (dir != -1) {
+        ds = DIR_DS[dir];
+        dt = DIR_DT[dir];
+    }
+    int target_s = game->player_s + ds;
+    int target_t = game->player_t + dt;
+
+    Tile const * tile = game->map().at(target_s, target_t);
+    if (!tile) return false;
+
+    if (tile->type == TileType::floor) {
+        // try to attack enemy there, if any
+        Entity * e = Entity::get_at(target_s, target_t);
+        if (e) {
+            if (e->is_hittable()) {
+                e->be_hit();
+            }
+        } else {
+            // otherwise move
+            game->player_s = target_s;
+            game->player_t = target_t;
+        }
+    } else if (tile->type == TileType::door) {
+        // open the door
+        MapData & map = game->map_for_write();
+        int i = map.index(target_s, target_t);
+        open_door(map, i);
+        if (telemetry) telemetry->push(TelemetryType::door_opened, 0, target_s, target_t);
+        if (listener) listener->tile_changed(i);
+    } else if (tile->type == TileType::wall) {
+        // TODO: try to dig it
+    }
+    return true;
+}
+
+// Times the phases of a turn into the thread's telemetry, if it has any.
+struct PhaseTimer
+{
+    int64_t last_ns = telemetry ? telemetry->now_ns() : 0;
+
+    void lap(TelemetryPhase phase)
+    {
+        if (!telemetry) return;
+        int64_t now = telemetry->now_ns();
+        telemetry->push(TelemetryType::phase, static_cast<int>(phase), static_cast<int>(now - last_ns));
+        last_ns = now;
+    }
+};
+
+void move_player(int dir)
+{
+    if (telemetry) telemetry->push(TelemetryType::turn_start, dir, game->player_s, game->player_t);
+    PhaseTimer timer;
+
+    if (player_act(dir)) {
+        timer.lap(TelemetryPhase::act);
+
+        compute_visibility_plus();
+        timer.lap(TelemetryPhase::visibility);
+
+        Entity::move_enemies();
+        timer.lap(TelemetryPhase::enemies);
+    }
+
+    if (telemetry) telemetry->push(TelemetryType::turn_end, game->player.health, game->player_s, game->player_t);
+}
+
+struct MapBuilder
+{
+    int player_s=0, player_t=0;
+    json tiles = json::array();
+    json entities = json::array();
+    json lights = json::array();
+
+    void player(int s, int t)
+    {
+        player_s = s;
+        player_t = t;
+    }
+
+    void tile(int s, int t, const char * type, int rotation = 0)
+    {
+        tiles.push_back({ { "s", s }, { "t", t }, { "type", type }, { "rotation", rotation } });
+    }
+
+    void entity(int s, int t, const char * type)
+    {
+        entities.push_back({ { "s", s }, { "t", t }, { "type", type } });
+    }
+
+    void light(int s, int t, int radius)
+    {
+        lights.push_back({ { "s", s }, { "t", t }, { "radius", radius } });
+    }
+
+    void hex_room(int min_s, int min_t, int s_len, int t_len, int trim_min, int trim_max)
+    {
+        int max_s = min_s + s_len;
+        int max_t = min_t + t_len;
+
+        FR(s, min_s, max_s+1) {
+            FR(t, min_t, max_t+1) {
+                int slack_min = (s - min_s + t - min_t) - trim_min;
+                int slack_max = (max_s - s + max_t - t) - trim_max;
+
+                if (slack_min < 0 || slack_max < 0) continue;
+
+                const char * type = "wall";
+                if (min_s < s && s < max_s && min_t < t && t < max_t && slack_min > 0 && slack_max > 0) {
+                    type = "floor";
+                }
+
+                tile(s, t, type);
+            }
+        }
+    }
+
+    json make_json()
+    {
+        json j;
+
+        j["player_s"] = player_s;
+        j["player_t"] = player_t;
+        j["tiles"] = tiles;
+        j["entities"] = entities;
+        j["lights"] = lights;
+
+        return j;
+    }
+};
+
+json random_map_json()
+{
+    MapBuilder b;
+
+    b.hex_room(0, -6, 7, 6, 3, 3);
+    b.hex_room(3, -12, 7, 6, 3, 3);
+
+    b.hex_room(4, -3, 7, 6, 3, 3);
+    b.hex_room(7, -9, 7, 6, 3, 3);
+    b.hex_room(10, -15, 7, 6, 3, 3);
+
+    b.hex_room(11, -6, 7, 6, 3, 3);
+    b.hex_room(14, -12, 7, 6, 3, 3);
+
+    b.tile(5, -6, "door", 0);
+    b.tile(7, -5, "door", 1);
+    b.tile(5, -1, "door", 2);
+
+    b.tile(10, -10, "door", 1);
+    b.tile(12, -9, "door", 0);
+    b.tile(11, -2, "door", 1);
+    b.tile(12, -4, "door", 2);
+
+    b.tile(15, -10, "door", 2);
+    b.tile(16, -6, "door", 0);
+
+    b.player(3, -3);
+
+    int const NROOM = 6;
+    int const PER_ROOM = 4;
+
+    std::vector<const char *> cohort = {
+        "enemy_skeleton_white",
+        "enemy_skeleton_white",
+        "enemy_skeleton_white",
+        "enemy_skeleton_white",
+        "enemy_skeleton_white",
+        "enemy_skeleton_white",
+        "enemy_slime_blue",
+        "enemy_slime_blue",
+        "enemy_slime_blue",
+        "enemy_slime_blue",
+
+        "enemy_bat_blue",
+        "enemy_bat_blue",
+        "enemy_bat_blue",
+        "enemy_bat_blue",
+        "enemy_bat_blue",
+        "enemy_bat_red",
+        "enemy_ghost",
+        "enemy_ghost",
+        "enemy_ghost",
+        "enemy_ghost",
+
+        "enemy_skeleton_white",
+        "enemy_skeleton_white",
+        "enemy_ghost",
+        "enemy_ghost",
+        };
+    assert(cohort.size() >= NROOM*PER_ROOM);
+
+    std::shuffle(BEND(cohort), game->prng);
+
+    int s0[NROOM] = { 3, 4, 7, 10, 11, 14 };
+    int t0[NROOM] = { -12, -3, -9, -15, -6, -12 };
+
+    FOR(i,NROOM) {
+        std::vector<const char *> contents;
+        FOR(j,PER_ROOM) {
+            contents.push_back(cohort.back());
+            cohort.pop_back();
+        }
+
+        b.entity(s0[i]+3, t0[i]+2, contents[0]);
+        b.entity(s0[i]+5, t0[i]+2, contents[1]);
+        b.entity(s0[i]+2, t0[i]+4, contents[2]);
+        b.entity(s0[i]+4, t0[i]+4, contents[3]);
+    }
+
+    // A torch in each room with enemies.
+    FOR(i,NROOM) {
+        b.light(s0[i]+6, t0[i]+3, 4);
+    }
+
+    return b.make_json();
+}
+
+// "stress:key=value,..." maps: a square grid of room slots, ROOM-1 floor
+// tiles a side, built straight into MapData since JSON can't keep up at
+// millions of tiles. Everything comes from the spec's own seed, so the same
+// spec is the same world every time.
+//
+//   tiles=10000      about how many cells the map has
+//   room=8           room pitch, walls included
+//   density=0.7      share of slots that are rooms; the rest are solid wall
+//   doors=2.5        doors per room on average, on walls between rooms, but
+//                    never fewer than it takes to join rooms that touch
+//   seed=1
+//   bat_blue=N, bat_red=N, slime_blue=N, ghost=N, skeleton_white=N
+//                    enemies of each type; with none given, one of a
+//                    random type per room
+//
+// The player starts in the middle of the first slot, which is always a room
+// and never has enemies.
+static void load_stress_map(std::string const & spec)
+{
+    int n_tiles = 10000, pitch = 8;
+    double density = 0.7, doors_per_room = 2.5;
+    unsigned seed = 1;
+    std::vector<std::pair<EntityType, int>> counts;
+
+    size_t pos = spec.find(':') + 1;
+    while (pos < spec.size()) {
+        size_t end = spec.find(',', pos);
+        if (end == std::string::npos) end = spec.size();
+        std::string item = spec.substr(pos, end - pos);
+        pos = end + 1;
+
+        size_t eq = item.find('=');
+        std::string key = item.substr(0, eq);
+        double value = eq == std::string::npos ? 0 : atof(item.c_str() + eq + 1);
+        if (key == "tiles") {
+            n_tiles = value;
+        } else if (key == "room") {
+            pitch = std::max(3, static_cast<int>(value));
+        } else if (key == "density") {
+            density = value;
+        } else if (key == "doors") {
+            doors_per_room = value;
+        } else if (key == "seed") {
+            seed = value;
+        } else {
+            counts.push_back(make_pair(Entity::deserialize_type("enemy_" + key), static_cast<int>(value)));
+        }
+    }
+
+    std::minstd_rand rng(seed);
+    std::uniform_real_distribution<double> unit(0, 1);
+
+    int side = std::max(1, static_cast<int>(std::sqrt(static_cast<double>(n_tiles)) / pitch));
+    int nslots = side * side;
+    int n = side * pitch + 1;
+
+    std::vector<bool> is_room(nslots);
+    FOR(k,nslots) is_room[k] = k == 0 || unit(rng) < density;
+
+    auto map = std::make_shared<MapData>();
+    map->path = spec;
+    map->n_s = n;
+    map->n_t = n;
+    map->tiles.resize(map->ncells());
+    FOR(i,map->ncells()) {
+        int s = map->s_of(i), t = map->t_of(i);
+        int slot_s = std::min(s / pitch, side - 1), slot_t = std::min(t / pitch, side - 1);
+        bool floor = s % pitch != 0 && t % pitch != 0 && is_room[slot_t * side + slot_s];
+        map->tiles[i].type = floor ? TileType::floor : TileType::wall;
+    }
+
+    // Walls between neighbouring rooms, in random order: first those that
+    // join two unconnected groups of rooms (Kruskal), then any others, until
+    // there are enough doors.
+    std::vector<std::pair<int,int>> walls;
+    FOR(k,nslots) {
+        if (!is_room[k]) continue;
+        if (k % side + 1 < side && is_room[k+1]) walls.push_back(make_pair(k, k+1));
+        if (k / side + 1 < side && is_room[k+side]) walls.push_back(make_pair(k, k+side));
+    }
+    std::shuffle(BEND(walls), rng);
+
+    std::vector<int> parent(nslots);
+    FOR(k,nslots) parent[k] = k;
+    auto find = [&](int k) {
+        while (parent[k] != k) k = parent[k] = parent[parent[k]];
+        return k;
+    };
+
+    int nrooms = std::count(BEND(is_room), true);
+    int want_doors = nrooms * doors_per_room / 2;
+    std::vector<bool> has_door(walls.size());
+    int ndoors = 0;
+    FOR(pass,2) {
+        FOR(w,static_cast<int>(walls.size())) {
+            if (has_door[w]) continue;
+            if (pass == 1 && ndoors >= want_doors) break;
+            int a = find(walls[w].first), b = find(walls[w].second);
+            if (pass == 0 && a == b) continue;
+            parent[a] = b;
+            has_door[w] = true;
+            ++ndoors;
+        }
+    }
+
+    FOR(w,static_cast<int>(walls.size())) {
+        if (!has_door[w]) continue;
+        auto [ a, b ] = walls[w];
+        int s = a % side * pitch + pitch/2, t = a / side * pitch + pitch/2;
+        Tile & tile = map->tiles[b == a+1 ? map->index(s + pitch/2 + pitch%2, t) : map->index(s, t + pitch/2 + pitch%2)];
+        tile.type = TileType::door;
+        tile.rotation = b == a+1 ? 1 : 0;
+    }
+
+    segment_rooms(*map);
+    game->shared_map = map;
+    resize_bits(game->is_visible, map->ncells());
+    resize_bits(game->tile_has_been_visible, map->ncells());
+
+    game->player_s = pitch/2;
+    game->player_t = pitch/2;
+
+    if (counts.empty()) {
+        FR(type,1,static_cast<int>(EntityType::skeleton_white)+1) counts.push_back(make_pair(static_cast<EntityType>(type), 0));
+        FR(k,1,nslots) counts[rng() % counts.size()].second += is_room[k];
+    }
+    std::vector<EntityType> types;
+    for (auto [ type, count ] : counts) types.insert(types.end(), count, type);
+
+    // Distinct floor tiles outside the first slot, by a partial shuffle.
+    std::vector<int> cells;
+    FOR(i,map->ncells()) {
+        if (map->tiles[i].type == TileType::floor && (map->s_of(i) > pitch || map->t_of(i) > pitch)) cells.push_back(i);
+    }
+    int nentities = std::min(types.size(), cells.size());
+
+    game->entities.clear();
+    game->entities.reserve(nentities);
+    FOR(k,nentities) {
+        std::swap(cells[k], cells[k + rng() % (cells.size() - k)]);
+
+        Entity e;
+        e.s = map->s_of(cells[k]);
+        e.t = map->t_of(cells[k]);
+        e.type = types[k];
+        e.init();
+        game->entities.push_back(e);
+    }
+}
+
+void load_map(std::string const & map_path)
+{
+    std::string const STRESS = "stress:";
+    if (map_path.compare(0, STRESS.size(), STRESS) == 0) {
+        load_stress_map(map_path);
+        return;
+    }
+
+    json j;
+    if (map_path == "random") {
+        j = random_map_json();
+    } else {
+        std::ifstream i(map_path);
+        i >> j;
+    }
+
+    std::vector<std::tuple<int, int, Tile>> tiles;
+    for (auto& rec : j["tiles"]) {
+        int s = rec["s"].get<int>();
+        int t = rec["t"].get<int>();
+        std::string type = rec["type"].get<std::string>();
+
+        Tile tile;
+        if (type == "wall") {
+            tile.type = TileType::wall;
+        } else if (type == "floor") {
+            tile.type = TileType::floor;
+        } else if (type == "door") {
+            tile.type = TileType::door;
+            tile.rotation = rec["rotation"].get<int>();
+        } else {
+            assert(!"Unrecognized tile type");
+        }
+
+        tiles.push_back(make_tuple(s, t, tile));
+    }
+
+    auto map = std::make_shared<MapData>();
+    map->path = map_path;
+    if (!tiles.empty()) {
+        int min_s = INT_MAX, max_s = INT_MIN, min_t = INT_MAX, max_t = INT_MIN;
+        for (auto& [ s, t, tile ] : tiles) {
+            min_s = std::min(min_s, s);
+            max_s = std::max(max_s, s);
+            min_t = std::min(min_t, t);
+            max_t = std::max(max_t, t);
+        }
+        map->min_s = min_s;
+        map->min_t = min_t;
+        map->n_s = max_s - min_s + 1;
+        map->n_t = max_t - min_t + 1;
+    }
+    map->tiles.assign(map->ncells(), Tile());
+    // Later records win, as they did when tiles were keyed in a std::map.
+    for (auto& [ s, t, tile ] : tiles) {
+        map->tiles[map->index(s, t)] = tile;
+    }
+    auto l_json = j.find("lights");
+    if (l_json != j.end()) {
+        for (auto& rec : *l_json) {
+            LightSource light;
+            light.s = rec["s"].get<int>();
+            light.t = rec["t"].get<int>();
+            light.radius = rec["radius"].get<int>();
+            map->lights.push_back(light);
+        }
+    }
+
+    segment_rooms(*map);
+    game->shared_map = map;
+    resize_bits(game->is_visible, map->ncells());
+    resize_bits(game->tile_has_been_visible, map->ncells());
+
+    auto e_json = j.find("entities");
+    assert(e_json != j.end());
+    game->entities.clear();
+    for (auto& rec : *e_json) {
+        Entity e;
+        e.s = rec["s"].get<int>();
+        e.t = rec["t"].get<int>();
+
+        std::string type = rec["type"].get<std::string>();
+        e.type = Entity::deserialize_type(type);
+        e.init();
+
+        game->entities.push_back(e);
+    }
+
+    auto s_json = j.find("spawns");
+    if (s_json != j.end()) {
+        int n_spawns = s_json->size();
+
+        std::vector<const char *> cohort;
+        bool any_red_bat = false;
+        FOR(i,n_spawns) {
+            double pos = i / static_cast<double>(n_spawns);
+
+            const char * etype = "enemy_skeleton_white";
+            if (pos < 0.25) {
+                etype = "enemy_ghost";
+            } else if (pos < 0.5) {
+                etype = "enemy_slime_blue";
+            } else if (pos < 0.75) {
+                etype = "enemy_bat_blue";
+                if (!any_red_bat) {
+                    etype = "enemy_bat_red";
+                    any_red_bat = true;
+                }
+            }
+
+            cohort.push_back(etype);
+        }
+
+        std::shuffle(BEND(cohort), game->prng);
+
+        for (auto& rec : *s_json) {
+            Entity e;
+            e.s = rec["s"].get<int>();
+            e.t = rec["t"].get<int>();
+
+            std::string type = cohort.back();
+            cohort.pop_back();
+            e.type = Entity::deserialize_type(type);
+            e.init();
+
+            game->entities.push_back(e);
+        }
+    }
+
+    game->player_s = j["player_s"].get<int>();
+    game->player_t = j["player_t"].get<int>();
+}
+
+void warp_to_map(std::string map_path)
+{
+    load_map(map_path);
+    game->player_prev_s = game->player_s;
+    game->player_prev_t = game->player_t;
+    game->player.health = game->player.max_health;
+
+    std::fill(BEND(game->tile_has_been_visible), 0);
+    compute_visibility_plus();
+    Entity::wake_visible();
+}
+
+std::vector<std::string> const BUILTIN_MAPS = {
+    "data/map_bat.json",
+    "data/map_slime.json",
+    "data/map_skeleton.json",
+    "data/map_skeleton_line.json",
+    "data/map_proto1.json",
+    "data/map_proto2.json",
+    "data/map_mix.json",
+    "data/map_untitled.json",
+    "random",
+};
+
+void reset_game()
+{
+    warp_to_map(game->map_path());
+}
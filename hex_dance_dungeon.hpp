@@ -1,7 +1,21 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <tuple>
+#include <vector>
+
 bool is_tile_opaque(int s, int t);
 void mark_tile_visible(int s, int t);
 
 void compute_visibility(int origin_s, int origin_t);
+// The same, but only marking tiles within radius of the origin.
+void compute_visibility_within(int origin_s, int origin_t, int radius);
+// The same shadowcasting without precomputed tables, to check compute_visibility against.
+void compute_visibility_reference(int origin_s, int origin_t);
 void compute_visibility_flood(int origin_s, int origin_t);
 
 // Utilities
@@ -18,3 +32,301 @@ int const DIR_DT[NDIRS] = {  0,  1,  1,  0, -1, -1 };
 #define FR(i,a,b) for(int i=(a);i<(b);++i)
 #define FOR(i,n) FR(i,0,n)
 #define BEND(v) (v).begin(),(v).end()
+
+// Game rules (game.cpp)
+//
+// Nothing below depends on SDL, so the rules can be driven headlessly too.
+
+const int WIN_WIDTH = 1280;
+const int WIN_HEIGHT = 720;
+
+int const HORIZONTAL_HALF_PERIOD_PX = 37;
+int const VERTICAL_HALF_PERIOD_PX = 60;
+
+int const ORIGIN_X_PX = WIN_WIDTH/2;
+int const ORIGIN_Y_PX = WIN_HEIGHT/2;
+
+int positive_mod(int x, int m);
+int dir_deviation(int d1, int d2);
+int hex_dist(int s1, int t1, int s2, int t2);
+int hex_dist_l2sq(int s1, int t1, int s2, int t2);
+std::tuple<int, int> hex_to_pixel(int s, int t);
+
+struct Player {
+    int max_health=4;
+    int health=0;
+};
+
+enum class TileType
+{
+    none,
+    floor,
+    wall,
+    door
+};
+
+struct Tile
+{
+    TileType type = TileType::none;
+    int rotation = 0;
+};
+
+enum class EntityType
+{
+    none,
+    bat_blue,
+    bat_red,
+    slime_blue,
+    ghost,
+    skeleton_white
+};
+
+enum class TweenType
+{
+    none,
+    move,
+    bump
+};
+
+struct Entity
+{
+    int s=0,t=0;
+    EntityType type = EntityType::none;
+
+    // What the entity did on the last beat, for the front end to animate:
+    // moved here from (motion_s, motion_t), or bumped into it.
+    TweenType last_motion = TweenType::none;
+    int motion_s=0, motion_t=0;
+
+    bool is_dead = false;
+    bool has_been_visible = false;
+
+    int frameTelegraph = 0;
+
+    int moveCooldownMax = 0;
+    int moveCooldown = 0;
+
+    int thinkCooldownMax = 0;
+    int thinkCooldown = 0;
+
+    // bat_blue, bat_red, slime_blue
+    int prep_dir = -1;
+
+    // slime_blue
+    int parity = 0;
+
+    // ghost
+    bool hiding = true;
+
+    // ghost, skeleton_white
+    int momentum_dir = 3;
+
+    bool is_inactive();
+    // Between floor cells sight is symmetric (a room sees all of itself), so
+    // this reads the player's visibility from this turn; if either stands off
+    // the floor, as on a door, it looks the player up in its room's list.
+    // No FOV of its own.
+    bool can_see_player();
+    void move();
+    void think();
+    bool is_hittable();
+    void be_hit();
+    void init();
+    std::tuple<int, int, int> priority_key();
+
+    static EntityType deserialize_type(std::string const & type);
+    static const char * serialize_type(EntityType type);
+
+    static thread_local std::vector<Entity*> prioritized;
+
+    static void move_enemies();
+    static void wake_visible();
+    // The live entities that can see the player, in one pass over the entities.
+    static void seeing_player(std::vector<Entity*> & out);
+    static Entity * get_at(int s, int t);
+    static bool is_at(int s, int t);
+};
+
+// A light fixed in the map: a torch, or a lamp big enough to light a room.
+struct LightSource
+{
+    int s=0, t=0;
+    int radius=0;
+};
+
+// Tiles of a loaded map, stored as a dense grid over their bounding box.
+// Cells without a tile have TileType::none.
+struct MapData
+{
+    // What it was loaded from; see load_map.
+    std::string path;
+
+    int min_s=0, min_t=0;
+    int n_s=0, n_t=0;
+    std::vector<Tile> tiles;
+
+    // From the map's "lights", if it has any.
+    std::vector<LightSource> lights;
+
+    // Rooms: connected regions of floor, found by segment_rooms. Since sight
+    // floods through floor, everything in a room sees the same tiles: the room
+    // and the walls and doors around it. Opening a door merges the rooms on
+    // either side of it (open_door), so rooms form a union-find.
+    std::vector<int> room_of;      // per cell: a room, or -1 if not floor
+    std::vector<int> room_parent;  // per room; roots are their own parent
+    // Per root room: the cells it sees, as room_seen[room_begin[r], room_end[r]),
+    // sorted and without repeats.
+    std::vector<int> room_begin, room_end;
+    std::vector<int> room_seen;
+    // How much of room_seen is lists of rooms merged away; see open_door.
+    size_t room_seen_dead = 0;
+
+    int room_root(int r) const
+    {
+        while (room_parent[r] != r) r = room_parent[r];
+        return r;
+    }
+
+    int ncells() const { return n_s * n_t; }
+
+    // -1 outside the bounding box
+    int index(int s, int t) const
+    {
+        s -= min_s;
+        t -= min_t;
+        if (static_cast<unsigned>(s) >= static_cast<unsigned>(n_s)) return -1;
+        if (static_cast<unsigned>(t) >= static_cast<unsigned>(n_t)) return -1;
+        return s*n_t + t;
+    }
+
+    int s_of(int i) const { return min_s + i / n_t; }
+    int t_of(int i) const { return min_t + i % n_t; }
+
+    Tile const * at(int s, int t) const
+    {
+        int i = index(s, t);
+        if (i < 0 || tiles[i].type == TileType::none) return NULL;
+        return &tiles[i];
+    }
+};
+
+// One bit per map cell.
+typedef std::vector<uint64_t> CellBits;
+
+inline bool test_bit(CellBits const & bits, int i) { return bits[i >> 6] >> (i & 63) & 1; }
+inline void set_bit(CellBits & bits, int i) { bits[i >> 6] |= uint64_t(1) << (i & 63); }
+inline void resize_bits(CellBits & bits, int n) { bits.assign((n + 63) / 64, 0); }
+
+// Everything that makes up one game in progress.
+//
+// This is a value type: copying it clones the game. The map, path and all, is
+// shared between clones until one of them changes a tile, and the rest is a
+// few flat arrays.
+struct GameState
+{
+    // Read through map(); write through map_for_write().
+    std::shared_ptr<MapData> shared_map;
+
+    CellBits is_visible;
+    CellBits tile_has_been_visible;
+
+    Player player;
+    int player_s=0, player_t=0;
+    // Where was the player at the start of the current turn?
+    int player_prev_s=0, player_prev_t=0;
+
+    std::vector<Entity> entities;
+
+    std::minstd_rand prng;
+
+    MapData const & map() const { return *shared_map; }
+    std::string const & map_path() const { return map().path; }
+
+    MapData & map_for_write()
+    {
+        if (shared_map.use_count() > 1) {
+            shared_map = std::make_shared<MapData>(*shared_map);
+        }
+        return *shared_map;
+    }
+
+    bool visible(int s, int t) const
+    {
+        int i = map().index(s, t);
+        return i >= 0 && test_bit(is_visible, i);
+    }
+
+    bool explored(int s, int t) const
+    {
+        int i = map().index(s, t);
+        return i >= 0 && test_bit(tile_has_been_visible, i);
+    }
+
+    int enemies_left() const
+    {
+        int n = 0;
+        for (auto& e : entities) {
+            if (!e.is_dead) ++n;
+        }
+        return n;
+    }
+
+    bool is_won() const { return enemies_left() == 0; }
+    bool is_lost() const { return player.health <= 0; }
+};
+
+// The game that the rules read and write. Each thread has its own,
+// so independent games can be stepped in parallel.
+extern thread_local GameState * game;
+
+// Hooks for tools that watch a game being played. Each thread has its own
+// listener, which may be NULL; searches that play out clones should clear it.
+struct GameListener
+{
+    virtual ~GameListener() {}
+
+    virtual void player_hit(Entity const & by) {}
+    virtual void enemy_killed(Entity const & e) {}
+    // Cell i turned from opaque to clear or back: a door opened, or an undo closed it.
+    virtual void tile_changed(int i) {}
+
+    // The rules are about to change e, or word w of tile_has_been_visible.
+    // Between them and the map, that's everything a turn changes besides the
+    // player and the RNG.
+    virtual void entity_changing(Entity const & e) {}
+    virtual void explored_changing(int w) {}
+};
+
+extern thread_local GameListener * listener;
+
+bool is_tile_blocking(int s, int t);
+void segment_rooms(MapData & map);
+void open_door(MapData & map, int i);
+
+// A root room and the cells it sees, as saved by rooms_around.
+struct SavedRoom
+{
+    int root;
+    std::vector<int> seen;
+};
+// The rooms that opening the door at cell i would merge.
+void rooms_around(MapData const & map, int i, std::vector<SavedRoom> & out);
+// Undoes the newest open_door(map, i), given what rooms_around saved first.
+void close_door(MapData & map, int i, Tile door, std::vector<SavedRoom> const & rooms);
+void compute_visibility_plus();
+void player_be_hit(Entity const & by);
+// A turn is the player's action, then compute_visibility_plus, then
+// Entity::move_enemies. player_act is the first part alone; it returns false
+// if dir leads off the map, and then the turn ends there.
+bool player_act(int dir);
+void move_player(int dir);
+
+// map_path is a JSON file, "random", or a generated
+// "stress:key=value,..." map (see load_stress_map).
+void load_map(std::string const & map_path);
+// Starts a new game on map_path, or over on the current one.
+void warp_to_map(std::string map_path);
+void reset_game();
+
+// The maps in data/ (see write_maps.py), then the "random" generator.
+extern std::vector<std::string> const BUILTIN_MAPS;
@@ -0,0 +1,150 @@
+#include <algorithm>
+
+#include "journal.hpp"
+
+TurnJournal::TurnJournal(int capacity)
+    : turns(capacity)
+{
+}
+
+void TurnJournal::play(int dir)
+{
+    if (turns.empty()) {
+        move_player(dir);
+        return;
+    }
+
+    newest = (newest + 1) % capacity();
+    count = std::min(count + 1, capacity());
+    ++serial;
+
+    Turn & turn = turns[newest];
+    turn.player_s = game->player_s;
+    turn.player_t = game->player_t;
+    turn.player_prev_s = game->player_prev_s;
+    turn.player_prev_t = game->player_prev_t;
+    turn.health = game->player.health;
+    turn.prng = game->prng;
+    turn.entities.clear();
+    turn.words.clear();
+    turn.door = -1;
+    turn.rooms.clear();
+
+    // The only tile a turn can change is the door the player moves into.
+    MapData const & map = game->map();
+    if (dir != -1) {
+        int target = map.index(game->player_s + DIR_DS[dir], game->player_t + DIR_DT[dir]);
+        if (target >= 0 && map.tiles[target].type == TileType::door) {
+            turn.door = target;
+            turn.door_tile = map.tiles[target];
+            rooms_around(map, target, turn.rooms);
+        }
+    }
+
+    if (entity_recorded.size() < game->entities.size()) entity_recorded.resize(game->entities.size(), 0);
+
+    next = listener;
+    listener = this;
+    move_player(dir);
+    listener = next;
+    next = NULL;
+
+    // Drop the door if it didn't open after all.
+    if (turn.door != -1 && game->map().tiles[turn.door].type == TileType::door) {
+        turn.door = -1;
+        turn.rooms.clear();
+    }
+}
+
+void TurnJournal::player_hit(Entity const & by)
+{
+    if (next) next->player_hit(by);
+}
+
+void TurnJournal::enemy_killed(Entity const & e)
+{
+    if (next) next->enemy_killed(e);
+}
+
+void TurnJournal::tile_changed(int i)
+{
+    if (next) next->tile_changed(i);
+}
+
+void TurnJournal::entity_changing(Entity const & e)
+{
+    int i = &e - game->entities.data();
+    if (entity_recorded[i] == serial) return;
+    entity_recorded[i] = serial;
+    turns[newest].entities.push_back({ i, e });
+}
+
+void TurnJournal::explored_changing(int w)
+{
+    turns[newest].words.push_back({ w, game->tile_has_been_visible[w] });
+}
+
+int TurnJournal::undo(int k)
+{
+    int undone = 0;
+    for (; undone < k && count > 0; ++undone) {
+        Turn const & turn = turns[newest];
+
+        for (auto& c : turn.entities) {
+            game->entities[c.index] = c.old;
+        }
+        if (turn.door != -1) {
+            close_door(game->map_for_write(), turn.door, turn.door_tile, turn.rooms);
+            if (listener) listener->tile_changed(turn.door);
+        }
+        for (auto& c : turn.words) {
+            game->tile_has_been_visible[c.index] = c.old_explored;
+        }
+
+        game->player_s = turn.player_s;
+        game->player_t = turn.player_t;
+        game->player_prev_s = turn.player_prev_s;
+        game->player_prev_t = turn.player_prev_t;
+        game->player.health = turn.health;
+        game->prng = turn.prng;
+
+        newest = (newest - 1 + capacity()) % capacity();
+        --count;
+    }
+
+    // Everything it sees was explored then, so this only puts is_visible back.
+    if (undone > 0) compute_visibility_plus();
+    return undone;
+}
+
+void TurnJournal::clear()
+{
+    newest = -1;
+    count = 0;
+}
+
+size_t TurnJournal::Turn::bytes() const
+{
+    size_t total = sizeof(Turn)
+        + entities.capacity() * sizeof(EntityChange)
+        + words.capacity() * sizeof(WordChange)
+        + rooms.capacity() * sizeof(SavedRoom);
+    for (auto& r : rooms) {
+        total += r.seen.capacity() * sizeof(int);
+    }
+    return total;
+}
+
+size_t TurnJournal::bytes() const
+{
+    size_t total = 0;
+    FOR(k,count) {
+        total += turns[(newest - k + capacity()) % capacity()].bytes();
+    }
+    return total;
+}
+
+size_t TurnJournal::last_turn_bytes() const
+{
+    return count > 0 ? turns[newest].bytes() : 0;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "hex_dance_dungeon.hpp"
+
+// Undo for turns, without copying the world: each turn played through the
+// journal records just what it changed (entities, the door it opened and the
+// rooms that merged, player position and health, the RNG, and the explored
+// words that changed), and undoing a turn writes those back. Visibility only
+// depends on the map and where the player is, so it's computed again.
+//
+// The rules say what they're about to change through the GameListener hooks;
+// while it plays a turn, the journal stands in as the thread's listener and
+// passes the rest on. So a turn costs what it changes, not the size of the
+// game: at most every entity, one door with its rooms and the explored words,
+// and usually far less. Undoing costs the same, plus one visibility update.
+//
+// The last `capacity` turns are kept in a ring; older ones are forgotten.
+//
+// Everything works on the thread's current game. Clear the journal whenever
+// that game is replaced wholesale (warps, loads).
+struct TurnJournal : GameListener
+{
+    explicit TurnJournal(int capacity = 256);
+
+    // Plays move_player(dir), recording how to undo it.
+    void play(int dir);
+
+    // Undoes up to k turns, newest first. Returns how many it undid.
+    int undo(int k);
+
+    void clear();
+
+    // Turns that can be undone.
+    int size() const { return count; }
+    int capacity() const { return static_cast<int>(turns.size()); }
+
+    // Memory used by the recorded turns, and by the newest one alone.
+    size_t bytes() const;
+    size_t last_turn_bytes() const;
+
+    void player_hit(Entity const & by) override;
+    void enemy_killed(Entity const & e) override;
+    void tile_changed(int i) override;
+    void entity_changing(Entity const & e) override;
+    void explored_changing(int w) override;
+
+private:
+    struct EntityChange
+    {
+        int index;
+        Entity old;
+    };
+
+    struct WordChange
+    {
+        int index;
+        uint64_t old_explored;
+    };
+
+    struct Turn
+    {
+        int player_s, player_t;
+        int player_prev_s, player_prev_t;
+        int health;
+        std::minstd_rand prng;
+
+        std::vector<EntityChange> entities;
+        std::vector<WordChange> words;
+
+        // The door opened, if any: its cell, and the rooms it merged.
+        int door = -1;
+        Tile door_tile;
+        std::vector<SavedRoom> rooms;
+
+        size_t bytes() const;
+    };
+
+    std::vector<Turn> turns;
+    int newest = -1;
+    int count = 0;
+
+    // The listener to pass events on to while playing a turn.
+    GameListener * next = NULL;
+
+    // Per entity: the last turn it was recorded in, so it's recorded once.
+    std::vector<long> entity_recorded;
+    long serial = 0;
+};
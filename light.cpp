@@ -0,0 +1,99 @@
+#include <algorithm>
+
+#include "light.hpp"
+
+using std::make_pair;
+
+void LightMap::reset()
+{
+    sources.clear();
+    level.assign(game->map().ncells(), 0);
+    for (auto& l : game->map().lights) {
+        add(l.s, l.t, l.radius);
+    }
+}
+
+int LightMap::add(int s, int t, int radius)
+{
+    Source src;
+    src.s = s;
+    src.t = t;
+    src.radius = radius;
+    src.alive = true;
+    sources.push_back(src);
+    light(sources.back());
+    return sources.size() - 1;
+}
+
+void LightMap::remove(int id)
+{
+    unlight(sources[id]);
+    sources[id].alive = false;
+}
+
+void LightMap::move(int id, int s, int t)
+{
+    Source & src = sources[id];
+    if (src.s == s && src.t == t) return;
+    unlight(src);
+    src.s = s;
+    src.t = t;
+    light(src);
+}
+
+void LightMap::tile_changed(int i)
+{
+    MapData const & map = game->map();
+    int s = map.s_of(i), t = map.t_of(i);
+    for (auto& src : sources) {
+        if (!src.alive || hex_dist(src.s, src.t, s, t) > src.radius) continue;
+
+        auto it = std::lower_bound(BEND(src.lit), make_pair(i, 0));
+        if (it == src.lit.end() || it->first != i) continue;
+
+        unlight(src);
+        light(src);
+    }
+}
+
+void LightMap::light(Source & src)
+{
+    ++recomputes;
+
+    MapData const & map = game->map();
+    scratch.shared_map = game->shared_map;
+    // Kept clear between calls, so only a new map size costs O(cells).
+    if (scratch.is_visible.size() != (map.ncells() + 63) / 64u) resize_bits(scratch.is_visible, map.ncells());
+
+    GameState * prev_game = game;
+    game = &scratch;
+    compute_visibility_within(src.s, src.t, src.radius);
+    game = prev_game;
+
+    // Everything marked is within the radius, so read and clear just that
+    // hexagon, in cell order.
+    src.lit.clear();
+    int r = std::max(src.radius, 0);
+    FR(ds,-r,r+1) {
+        FR(dt,std::max(-r, -ds-r),std::min(r, -ds+r)+1) {
+            int i = map.index(src.s + ds, src.t + dt);
+            if (i < 0 || !test_bit(scratch.is_visible, i)) continue;
+            scratch.is_visible[i >> 6] &= ~(uint64_t(1) << (i & 63));
+
+            int amount = src.radius + 1 - hex_dist(0, 0, ds, dt);
+            src.lit.push_back(make_pair(i, amount));
+            level[i] += amount;
+        }
+    }
+
+    // Don't hold on to the map past a warp.
+    scratch.shared_map.reset();
+}
+
+void LightMap::unlight(Source & src)
+{
+    for (auto [ i, amount ] : src.lit) {
+        level[i] -= amount;
+    }
+    src.lit.clear();
+}
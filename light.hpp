@@ -0,0 +1,58 @@
+#pragma once
+
+#include <utility>
+#include <vector>
+
+#include "hex_dance_dungeon.hpp"
+
+// Light levels over the current map, from any number of sources: the map's
+// own lights, and any the front end adds (such as one following the player,
+// for a limited sight radius).
+//
+// A source lights the tiles compute_visibility_within sees from it, by
+// radius + 1 - distance, and a tile's level is the sum over sources. Each
+// source remembers what it lit, so it can be taken back out of the sum;
+// the map is only touched where a source changes. A source is recomputed
+// only when it moves, or when a tile it lit turns opaque or clear. Tiles it
+// didn't light can't change what it sees. So static lights cost nothing from
+// turn to turn.
+//
+// Install it as the thread's listener to hear about doors. Everything works
+// on the thread's current game; call reset() whenever that is replaced.
+struct LightMap : GameListener
+{
+    // Per cell of the current map.
+    std::vector<int> level;
+
+    // Drops every source, then adds the map's own.
+    void reset();
+
+    // Returns an id for move() and remove().
+    int add(int s, int t, int radius);
+    void remove(int id);
+    // Recomputes the source only if it actually moved.
+    void move(int id, int s, int t);
+
+    void tile_changed(int i) override;
+
+    // How many times a source has been computed, to see that updates stay incremental.
+    long recomputes = 0;
+
+private:
+    struct Source
+    {
+        int s=0, t=0, radius=0;
+        bool alive = false;
+        // (cell, light) for each cell it lights, by cell.
+        std::vector<std::pair<int,int>> lit;
+    };
+
+    std::vector<Source> sources;
+
+    // compute_visibility marks into the thread's game; this is the game it
+    // marks into, sharing the current map.
+    GameState scratch;
+
+    void light(Source & src);
+    void unlight(Source & src);
+};
@@ -0,0 +1,107 @@
+#include "loader.hpp"
+
+WorldLoader::WorldLoader(std::function<void()> on_ready)
+    : on_ready(on_ready)
+{
+#ifndef __EMSCRIPTEN__
+    worker = std::thread([this] { worker_main(); });
+#endif
+}
+
+WorldLoader::~WorldLoader()
+{
+#ifndef __EMSCRIPTEN__
+    {
+        std::lock_guard<std::mutex> lock(mu);
+        stopping = true;
+    }
+    work_posted.notify_all();
+    worker.join();
+#endif
+}
+
+GameState WorldLoader::prepare(std::string const & map_path, unsigned seed)
+{
+    GameState state;
+    state.prng.seed(seed);
+
+    // The rules work on the thread's current game.
+    GameState * saved_game = game;
+    GameListener * saved_listener = listener;
+    game = &state;
+    listener = NULL;
+
+    warp_to_map(map_path);
+
+    game = saved_game;
+    listener = saved_listener;
+    return state;
+}
+
+void WorldLoader::preload(std::string const & map_path, unsigned seed)
+{
+#ifdef __EMSCRIPTEN__
+    // No threads on the web build: prepare it now.
+    if (is_ready(map_path)) return;
+    prepared.push_back(prepare(map_path, seed));
+    if (on_ready) on_ready();
+#else
+    {
+        std::lock_guard<std::mutex> lock(mu);
+        if (loading == map_path) return;
+        for (auto& q : queue) {
+            if (q.first == map_path) return;
+        }
+        for (auto& g : prepared) {
+            if (g.map_path() == map_path) return;
+        }
+        queue.push_back(make_pair(map_path, seed));
+    }
+    work_posted.notify_one();
+#endif
+}
+
+bool WorldLoader::take(std::string const & map_path, GameState & out)
+{
+    std::lock_guard<std::mutex> lock(mu);
+    FOR(i,static_cast<int>(prepared.size())) {
+        if (prepared[i].map_path() != map_path) continue;
+        out = std::move(prepared[i]);
+        prepared.erase(prepared.begin() + i);
+        return true;
+    }
+    return false;
+}
+
+bool WorldLoader::is_ready(std::string const & map_path)
+{
+    std::lock_guard<std::mutex> lock(mu);
+    for (auto& g : prepared) {
+        if (g.map_path() == map_path) return true;
+    }
+    return false;
+}
+
+void WorldLoader::worker_main()
+{
+    std::unique_lock<std::mutex> lock(mu);
+    while (true) {
+        work_posted.wait(lock, [this] { return stopping || !queue.empty(); });
+        if (stopping) return;
+
+        auto [ map_path, seed ] = queue.front();
+        queue.pop_front();
+        loading = map_path;
+
+        lock.unlock();
+        GameState state = prepare(map_path, seed);
+        lock.lock();
+
+        loading.clear();
+        prepared.push_back(std::move(state));
+
+        lock.unlock();
+        if (on_ready) on_ready();
+        lock.lock();
+    }
+}
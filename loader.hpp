@@ -0,0 +1,57 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "hex_dance_dungeon.hpp"
+
+// Prepares fresh games on a background thread, so switching maps doesn't
+// stall the caller: parsing or generating the map and the first visibility
+// pass all happen on the loader's thread.
+//
+// The caller swaps a prepared game in whenever it likes, e.g.
+//     if (loader.take(path, the_game)) ...
+// which is just a move of the GameState.
+struct WorldLoader
+{
+    // on_ready, if set, is called on the loader thread after each game is prepared.
+    explicit WorldLoader(std::function<void()> on_ready = nullptr);
+    ~WorldLoader();
+
+    WorldLoader(WorldLoader const &) = delete;
+    WorldLoader & operator=(WorldLoader const &) = delete;
+
+    // Starts preparing a game on map_path, as warp_to_map would, unless one is
+    // already prepared or on its way. The new game's prng is seeded with seed.
+    void preload(std::string const & map_path, unsigned seed);
+
+    // Moves the prepared game for map_path into out. Returns false, leaving
+    // out alone, if it isn't ready yet.
+    bool take(std::string const & map_path, GameState & out);
+
+    bool is_ready(std::string const & map_path);
+
+private:
+    void worker_main();
+    static GameState prepare(std::string const & map_path, unsigned seed);
+
+    std::function<void()> on_ready;
+
+    std::mutex mu;
+    std::condition_variable work_posted;
+    bool stopping = false;
+
+    std::deque<std::pair<std::string, unsigned>> queue;
+    std::string loading;
+    std::vector<GameState> prepared;
+
+#ifndef __EMSCRIPTEN__
+    std::thread worker;
+#endif
+};
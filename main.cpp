@@ -1,13 +1,19 @@
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cctype>
+#include <chrono>
 #include <cmath>
 #include <cstdlib>
+#include <condition_variable>
 #include <cstdio>
 #include <ctime>
+#include <deque>
 #include <fstream>
 #include <map>
-#include <random>
-#include <set>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <vector>
 
 #include <SDL.h>
@@ -18,14 +24,18 @@
 #include <emscripten.h>
 #endif
 
-// https://github.com/nlohmann/json
-#include "nlohmann/json.hpp"
-
+#include "anim.hpp"
+#include "assetpack.hpp"
+#include "floorcache.hpp"
 #include "hex_dance_dungeon.hpp"
+#include "journal.hpp"
+#include "light.hpp"
+#include "loader.hpp"
+#include "savegame.hpp"
+#include "telemetry.hpp"
 
 using std::make_pair;
 using std::unique_ptr;
-using nlohmann::json;
 using std::make_tuple;
 
 // SDL utilities
@@ -66,6 +76,37 @@ void failIMG(const char * msg)
 }
 #define CHECK_IMG(expr) if ((expr) < 0) failIMG(#expr)
 
+// Draw calls and texture switches in the frame being drawn, for the render
+// benchmark. Main thread only.
+struct DrawStats
+{
+    int draws = 0;
+    int texture_switches = 0;
+    SDL_Texture * last_tex = NULL;
+};
+DrawStats draw_stats;
+
+void count_draw(SDL_Texture * tex)
+{
+    ++draw_stats.draws;
+    if (tex != draw_stats.last_tex) {
+        ++draw_stats.texture_switches;
+        draw_stats.last_tex = tex;
+    }
+}
+
+int RenderCopy(SDL_Renderer * ren, SDL_Texture * tex, SDL_Rect const * src, SDL_Rect const * dst)
+{
+    count_draw(tex);
+    return SDL_RenderCopy(ren, tex, src, dst);
+}
+
+int RenderFillRect(SDL_Renderer * ren, SDL_Rect const * rect)
+{
+    count_draw(NULL);
+    return SDL_RenderFillRect(ren, rect);
+}
+
 int const TEXT_ALIGNH_LEFT = 0;
 int const TEXT_ALIGNH_CENTER = 1;
 int const TEXT_ALIGNH_RIGHT = 2;
@@ -91,14 +132,9 @@ void DrawText(SDL_Renderer * ren, TTF_Font * font, const char * s, SDL_Color col
     }
 
     SDL_Rect dst = { x, y, *textW, *textH };
-    if (SDL_RenderCopy(ren, textTex.get(), NULL, &dst) < 0) failSDL("SDL_RenderCopy");
-}
-
-SDL_Texture * LoadTexture(SDL_Renderer * ren, const char * path)
-{
-    SDL_Texture *tex = IMG_LoadTexture(ren, path);
-    if (!tex) failIMG("LoadTexture");
-    return tex;
+    if (RenderCopy(ren, textTex.get(), NULL, &dst) < 0) failSDL("SDL_RenderCopy");
+    // The texture goes now, and the next one may get its address.
+    draw_stats.last_tex = NULL;
 }
 
 // SDL data, cleanup, etc.
@@ -106,1087 +142,1089 @@ SDL_Window * win = NULL;
 TTF_Font * font = NULL;
 SDL_Renderer * ren = NULL;
 
-sdl_ptr<SDL_Texture> tile_floor;
-int tile_floor_w;
-int tile_floor_h;
-sdl_ptr<SDL_Texture> tile_wall;
-int const NDOOR = 3;
-sdl_ptr<SDL_Texture> tile_door[NDOOR];
-
 struct Sprite
 {
+    // NULL until the image has been decoded and uploaded. Don't draw it before then.
     sdl_ptr<SDL_Texture> tex;
-    int w, h;
+    int w=0, h=0;
+    int nframes=1;
 };
 
 std::map<std::string, unique_ptr<Sprite>> sprites;
 
-void LoadSprite(const char * path, int nframes = 1)
+Sprite * tile_floor;
+Sprite * tile_wall;
+int const NDOOR = 3;
+Sprite * tile_door[NDOOR];
+Sprite * heart_empty;
+Sprite * heart_full;
+
+// Asset loading
+//
+// If data/assets.pack exists, sprites and the font come straight out of it:
+// the pixels are already decoded, so a sprite is uploaded on the next frame drawn.
+//
+// Otherwise PNGs are decoded into surfaces on worker threads, then turned into textures
+// on the main thread (which owns the renderer) as they finish, so startup
+// doesn't wait for them. Sprites are requested when something first needs them.
+struct DecodedImage
 {
-    unique_ptr<Sprite> s(new Sprite);
-    s->tex.reset(LoadTexture(ren, path));
-    CHECK_SDL(SDL_QueryTexture(s->tex.get(), NULL, NULL, &s->w, &s->h));
-    s->w /= nframes;
-    sprites[path] = std::move(s);
-}
+    std::string path;
+    Sprite * sprite;
+    SDL_Surface * surf;
+    std::string error;
+    // Set instead of surf for sprites in the asset pack.
+    PackEntry const * packed;
+};
 
-void cleanup()
-{
-    tile_floor.reset();
-    tile_wall.reset();
-    sprites.clear();
+#ifndef __EMSCRIPTEN__
+int const NDECODERS = 4;
+std::vector<std::thread> decoders;
+#endif
+std::mutex decode_mu;
+std::condition_variable decode_cv;
+bool decoders_stopping = false;
+// Waiting to be decoded, then waiting to be uploaded.
+std::deque<DecodedImage> decode_queue;
+std::vector<DecodedImage> decoded;
 
-    if (ren) SDL_DestroyRenderer(ren);
-    if (font) TTF_CloseFont(font);
-    if (win) SDL_DestroyWindow(win);
+const char * const ASSET_PACK_PATH = "data/assets.pack";
+AssetPack asset_pack;
 
-    IMG_Quit();
-    TTF_Quit();
-    SDL_Quit();
-}
+// Requested but not yet uploaded.
+std::atomic<int> sprites_pending(0);
 
-// FPS tracking
-const int CIRCBUF_LEN = 64;
-Uint32 circbuf[CIRCBUF_LEN];
-int circbuf_i;
+// Redraw tracking
+//
+// Set when something on screen may have changed since the last frame was drawn:
+// a new snapshot or a texture arriving. Tweens and the camera keep frames coming
+// through animate() while they move.
+// Frames that wouldn't change anything are skipped. Main thread only.
+bool frame_dirty = true;
 
-void initFPSTracking()
-{
-    memset(circbuf, 0, sizeof(circbuf));
-    circbuf_i = 0;
-}
+// The idle loops wake up this often even without events, just in case.
+Uint32 const IDLE_WAKEUP_MS = 1000;
 
-void accumTime(Uint32 ms)
-{
-    circbuf[circbuf_i++] = ms;
-    if (circbuf_i >= CIRCBUF_LEN) circbuf_i = 0;
-}
+void wake_renderer();
 
-double avgFrameTime_ms()
+void DecodeImage(DecodedImage & img)
 {
-    double ret = 0;
-    FOR(i, CIRCBUF_LEN) ret += circbuf[i];
-    return ret / CIRCBUF_LEN;
+    img.surf = IMG_Load(img.path.c_str());
+    if (!img.surf) img.error = IMG_GetError();
 }
 
-// main code
-std::minstd_rand prng;
-
-bool cheat_vis = false;
-
-const int WIN_WIDTH = 1280;
-const int WIN_HEIGHT = 720;
-
-const int FONT_HEIGHT = 16;
+#ifndef __EMSCRIPTEN__
+void decoder_main()
+{
+    std::unique_lock<std::mutex> lock(decode_mu);
+    while (true) {
+        decode_cv.wait(lock, [] { return decoders_stopping || !decode_queue.empty(); });
+        if (decoders_stopping) return;
 
-int const HORIZONTAL_HALF_PERIOD_PX = 37;
-int const VERTICAL_HALF_PERIOD_PX = 60;
+        DecodedImage img = decode_queue.front();
+        decode_queue.pop_front();
 
-int const ORIGIN_X_PX = WIN_WIDTH/2;
-int const ORIGIN_Y_PX = WIN_HEIGHT/2;
+        lock.unlock();
+        DecodeImage(img);
+        lock.lock();
 
-double deltaFrame_s;
+        decoded.push_back(img);
 
-// Many of the hex grid routines are informed by
-// https://www.redblobgames.com/grids/hexagons
-int positive_mod(int x, int m)
-{
-    return (x % m + m) % m;
+        // Wake the main thread if it's idle, so the image gets uploaded and drawn.
+        wake_renderer();
+    }
 }
+#endif
 
-// Means: how many 60-degree increments separate these two directions.
-int dir_deviation(int d1, int d2)
+void start_decoders()
 {
-    return std::min(positive_mod(d2-d1, NDIRS), positive_mod(d1-d2, NDIRS));
+#ifndef __EMSCRIPTEN__
+    FOR(i,NDECODERS) {
+        decoders.emplace_back(decoder_main);
+    }
+#endif
 }
 
-int hex_dist(int s1, int t1, int s2, int t2)
+void stop_decoders()
 {
-    int p1 = -s1-t1;
-    int p2 = -s2-t2;
+    {
+        std::lock_guard<std::mutex> lock(decode_mu);
+        decoders_stopping = true;
+    }
+    decode_cv.notify_all();
+
+#ifndef __EMSCRIPTEN__
+    for (auto& d : decoders) {
+        d.join();
+    }
+    decoders.clear();
+#endif
 
-    return (abs(s1-s2) + abs(t1-t2) + abs(p1-p2))/2;
+    for (auto& img : decoded) {
+        if (img.surf) SDL_FreeSurface(img.surf);
+    }
+    decoded.clear();
 }
 
-int hex_dist_l2sq(int s1, int t1, int s2, int t2)
+void UploadPackedSprite(Sprite * s, PackEntry const & e)
 {
-    // This formula assumes that the center-to-center distance of adjacent hexes is 1.
-    int ds = s2-s1, dt = t2-t1;
-    return ds*ds + dt*dt + ds*dt;
+    s->tex.reset(SDL_CreateTexture(ren, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STATIC, e.w, e.h));
+    if (!s->tex) failSDL("SDL_CreateTexture");
+    CHECK_SDL(SDL_UpdateTexture(s->tex.get(), NULL, asset_pack.blob(e), e.w * 4));
+    CHECK_SDL(SDL_SetTextureBlendMode(s->tex.get(), SDL_BLENDMODE_BLEND));
+    s->nframes = e.nframes;
+    s->w = e.w / e.nframes;
+    s->h = e.h;
 }
 
-std::tuple<int, int> hex_to_pixel(int s, int t)
+// Loads the image at path, unless it's been requested already.
+// The returned sprite can be drawn once its tex is set.
+// Simulation thread only; the texture is made on the main thread.
+Sprite * RequestSprite(std::string const & path)
 {
-    int p = -s-t;
+    auto it = sprites.find(path);
+    if (it != sprites.end()) return it->second.get();
 
-    return make_tuple(
-            ORIGIN_X_PX + HORIZONTAL_HALF_PERIOD_PX * (s - p),
-            ORIGIN_Y_PX - VERTICAL_HALF_PERIOD_PX * t);
-}
+    unique_ptr<Sprite> s(new Sprite);
+    s->nframes = sprite_nframes(path);
+    Sprite * ret = s.get();
+    sprites[path] = std::move(s);
 
-int camera_x_px;
-int camera_y_px;
+    ++sprites_pending;
 
-std::tuple<int, int> pixel_to_screen(std::tuple<int, int> pos)
-{
-    auto [ x_px, y_px ] = pos;
-    return make_tuple(x_px - camera_x_px, y_px - camera_y_px);
+    PackEntry const * e = asset_pack.find(path);
+    if (e && e->kind == PACK_KIND_IMAGE) {
+        {
+            std::lock_guard<std::mutex> lock(decode_mu);
+            decoded.push_back({ path, ret, NULL, "", e });
+        }
+        wake_renderer();
+        return ret;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(decode_mu);
+        decode_queue.push_back({ path, ret, NULL, "", NULL });
+    }
+    decode_cv.notify_one();
+
+    return ret;
 }
 
-std::tuple<int, int> hex_to_screen(int s, int t)
+// Uploads whatever finished decoding since the last call. Call once per frame,
+// on the main thread.
+void UploadDecodedSprites()
 {
-    return pixel_to_screen(hex_to_pixel(s, t));
-}
+    std::vector<DecodedImage> done;
+    {
+        std::lock_guard<std::mutex> lock(decode_mu);
+        std::swap(done, decoded);
+#ifdef __EMSCRIPTEN__
+        // No worker threads on the web build: decode one image per frame here instead.
+        if (!decode_queue.empty()) {
+            done.push_back(decode_queue.front());
+            decode_queue.pop_front();
+            DecodeImage(done.back());
+        }
+#endif
+    }
 
-double const CAMERA_TWEEN_SPEED = 10.0;
+    for (auto& img : done) {
+        Sprite * s = img.sprite;
+        if (img.packed) {
+            UploadPackedSprite(s, *img.packed);
+        } else {
+            if (!img.surf) {
+                std::printf("IMG_Load(%s) failed: %s\n", img.path.c_str(), img.error.c_str());
+                exit(1);
+            }
+
+            s->tex.reset(SDL_CreateTextureFromSurface(ren, img.surf));
+            if (!s->tex) failSDL("SDL_CreateTextureFromSurface");
+            s->w = img.surf->w / s->nframes;
+            s->h = img.surf->h;
 
-int player_s, player_t;
-// Where was the player at the start of the current turn?
-int player_prev_s, player_prev_t;
+            SDL_FreeSurface(img.surf);
+        }
+        --sprites_pending;
+        frame_dirty = true;
+    }
+}
 
-struct Player {
-    int max_health=4;
-    int health=0;
-} player;
+// Time-to-first-frame reporting
+Uint64 startup_counter;
+bool first_frame_reported = false;
+bool startup_assets_reported = false;
 
-enum class TileType
+double ms_since_startup()
 {
-    none,
-    floor,
-    wall,
-    door
-};
+    return (SDL_GetPerformanceCounter() - startup_counter) * 1000.0 / SDL_GetPerformanceFrequency();
+}
 
-struct Tile
+void cleanup()
 {
-    TileType type = TileType::none;
-    int rotation = 0;
-};
+    stop_decoders();
+    sprites.clear();
 
-std::map<std::pair<int,int>, Tile> tiles;
+    if (ren) SDL_DestroyRenderer(ren);
+    if (font) TTF_CloseFont(font);
+    if (win) SDL_DestroyWindow(win);
 
-std::set<std::tuple<int,int>> is_visible;
-std::set<std::tuple<int,int>> tile_has_been_visible;
+    // The font may still be reading from the pack until it's closed.
+    asset_pack.close();
 
-void mark_tile_visible(int s, int t)
-{
-    if (tiles.find(make_pair(s,t)) != tiles.end()) {
-        is_visible.insert(make_tuple(s,t));
-    }
+    IMG_Quit();
+    TTF_Quit();
+    SDL_Quit();
 }
 
-bool is_tile_opaque(int s, int t)
-{
-    auto it = tiles.find(make_pair(s,t));
-    if (it == tiles.end()) return true;
-    return it->second.type != TileType::floor;
-}
+// FPS tracking
+const int CIRCBUF_LEN = 64;
+Uint32 circbuf[CIRCBUF_LEN];
+int circbuf_i;
 
-bool is_tile_blocking(int s, int t)
+void initFPSTracking()
 {
-    auto i = tiles.find(make_pair(s,t));
-    if (i == tiles.end()) return false;
-    return i->second.type != TileType::floor;
+    memset(circbuf, 0, sizeof(circbuf));
+    circbuf_i = 0;
 }
 
-void compute_visibility_plus()
+void accumTime(Uint32 ms)
 {
-    is_visible.clear();
-    compute_visibility_flood(player_s, player_t);
-    for (auto& h : is_visible) {
-        tile_has_been_visible.insert(h);
-    }
+    circbuf[circbuf_i++] = ms;
+    if (circbuf_i >= CIRCBUF_LEN) circbuf_i = 0;
 }
 
-void player_be_hit()
+double avgFrameTime_ms()
 {
-    fprintf(stderr, "player was hit\n");
-    player.health -= 1;
+    double ret = 0;
+    FOR(i, CIRCBUF_LEN) ret += circbuf[i];
+    return ret / CIRCBUF_LEN;
 }
 
-Sprite * telegraph_arrows[6];
-
-enum class EntityType
+// Frame pacing
+//
+// Animation time advances in whole ANIM_STEP_S steps, so tweens play the same
+// however uneven the frames are. Frames are presented with vsync when the
+// renderer really blocks on it; otherwise we sleep until the next frame is due
+// rather than spinning. The browser paces the web build itself.
+double const TARGET_FPS = 60.0;
+double const ANIM_STEP_S = 1.0 / 240;
+// After a stall (window dragged, debugger), don't replay more than this.
+double const MAX_ANIM_CATCHUP_S = 0.25;
+
+double seconds_between(Uint64 from, Uint64 to)
 {
-    none,
-    bat_blue,
-    bat_red,
-    slime_blue,
-    ghost,
-    skeleton_white
-};
+    return (to - from) / static_cast<double>(SDL_GetPerformanceFrequency());
+}
 
-enum class TweenType
+struct FramePacer
 {
-    none,
-    move,
-    bump
-};
+    double period_s = 1.0 / TARGET_FPS;
+    bool vsync = false;
 
-double const TWEEN_MOVE_LEN_S = 0.08;
-double const TWEEN_BUMP_LEN_S = 0.08;
+    Uint64 frame_start = 0;
+    Uint64 prev_frame_start = 0;
+    double anim_debt_s = 0;
 
-struct Tweener
-{
-    TweenType type = TweenType::none;
-    int src_x_px=0, src_y_px=0, dst_x_px=0, dst_y_px=0;
-    double t = 0.0;
+    long frames = 0;
+    long missed = 0;
 
-    void ease_move_px(std::tuple<int,int> src_px, std::tuple<int, int> dst_px)
+    void start(bool renderer_vsync)
     {
-        type = TweenType::move;
-        std::tie(src_x_px, src_y_px) = src_px;
-        std::tie(dst_x_px, dst_y_px) = dst_px;
-        t = 0;
+        vsync = renderer_vsync;
+        frame_start = prev_frame_start = SDL_GetPerformanceCounter();
     }
 
-    void ease_bump_px(std::tuple<int, int> dst_px, std::tuple<int, int> bumped_px)
+    // Call at the start of a frame. Returns how far to advance animation.
+    double begin_frame()
     {
-        type = TweenType::bump;
-        std::tie(src_x_px, src_y_px) = bumped_px;
-        std::tie(dst_x_px, dst_y_px) = dst_px;
-        t = 0;
+        prev_frame_start = frame_start;
+        frame_start = SDL_GetPerformanceCounter();
+
+        double real_dt_s = seconds_between(prev_frame_start, frame_start);
+        if (frames > 0 && real_dt_s > 1.5 * period_s) ++missed;
+        ++frames;
+
+        anim_debt_s = std::min(anim_debt_s + real_dt_s, MAX_ANIM_CATCHUP_S);
+        int steps = static_cast<int>(anim_debt_s / ANIM_STEP_S);
+        anim_debt_s -= steps * ANIM_STEP_S;
+        return steps * ANIM_STEP_S;
     }
 
-    void set_pos_px(std::tuple<int, int> pos_px)
+    // Call after the loop has been blocked waiting for input, so the wait
+    // doesn't count as a missed frame or get replayed as animation.
+    void resume_after_idle()
     {
-        type = TweenType::none;
-        std::tie(dst_x_px, dst_y_px) = pos_px;
-        t = 0;
+        frame_start = SDL_GetPerformanceCounter();
+        anim_debt_s = 0;
     }
 
-    std::tuple<int, int> get_pos_px()
+    // Call after presenting. Sleeps off whatever is left of this frame's budget,
+    // unless present already waited for vsync.
+    void end_frame()
     {
-        if (type == TweenType::none) return make_tuple(dst_x_px, dst_y_px);
+        double busy_s = seconds_between(frame_start, SDL_GetPerformanceCounter());
 
-        double tween_len_s = 0.0;
-        if (type == TweenType::move) tween_len_s = TWEEN_MOVE_LEN_S;
-        if (type == TweenType::bump) tween_len_s = TWEEN_BUMP_LEN_S;
+        // A vsynced present takes most of a frame. If it came back much sooner,
+        // the driver isn't really syncing (e.g. a hidden window), so pace ourselves.
+        if (vsync && busy_s > period_s / 2) return;
 
-        t += deltaFrame_s;
-        if (t > tween_len_s) {
-            type = TweenType::none;
-            return make_tuple(dst_x_px, dst_y_px);
-        }
-        double pct = (tween_len_s - t) / tween_len_s;
-        int x_px = dst_x_px, y_px = dst_y_px;
-        double alpha = (1 - cos(pct * M_PI / 2));
-
-        if (type == TweenType::bump) {
-            if (alpha > 0.5) alpha = 1.0 - alpha;
-            alpha *= 0.5;
-        }
-
-        x_px += static_cast<int>(round((src_x_px - x_px) * alpha));
-        y_px += static_cast<int>(round((src_y_px - y_px) * alpha));
-
-        return make_tuple(x_px, y_px);
+        // SDL_Delay may oversleep by about a millisecond; wake up early instead of late.
+        double wait_s = period_s - busy_s - 0.001;
+        if (wait_s > 0) SDL_Delay(static_cast<Uint32>(wait_s * 1000));
     }
 };
 
-bool should_render_tile(int s, int t)
-{
-    return cheat_vis || tile_has_been_visible.find(make_tuple(s,t)) != tile_has_been_visible.end();
-}
-
-struct Entity
-{
-    int s=0,t=0;
-    EntityType type = EntityType::none;
-
-    Sprite * sprite = NULL;
-    Tweener tweener;
-    bool is_dead = false;
-    bool has_been_visible = false;
-
-    int frameTelegraph = 0;
+FramePacer frame_pacer;
 
-    int moveCooldownMax = 0;
-    int moveCooldown = 0;
-
-    int thinkCooldownMax = 0;
-    int thinkCooldown = 0;
+// main code
+//
+// The main thread pumps events and draws, since SDL wants both on the thread
+// that made the window; a simulation thread plays the game. They share
+// nothing but the input queue and frame snapshots, so a slow turn doesn't drop
+// frames and a slow frame doesn't hold up the next turn. The web build has no
+// threads and does both in turn from main_loop().
+GameState the_game;
+
+// Game events from the simulation thread, written out as they happen
+// (see telemetry.hpp). Native builds only; the web build has no threads.
+const char * const TELEMETRY_PATH = "telemetry.ndjson";
+Telemetry the_telemetry;
 
-    // bat_blue, bat_red, slime_blue
-    int prep_dir = -1;
+bool cheat_vis = false;
 
-    // slime_blue
-    int parity = 0;
+// Set for the render benchmark (see run_render_bench).
+bool render_bench = false;
 
-    // ghost
-    bool hiding = true;
+const int FONT_HEIGHT = 16;
 
-    // ghost, skeleton_white
-    int momentum_dir = 3;
+Sprite * telegraph_arrows[NDIRS];
+int const NENTITY_TYPES = static_cast<int>(EntityType::skeleton_white) + 1;
+Sprite * entity_sprites[NENTITY_TYPES];
 
-    bool is_inactive()
-    {
-        return is_dead || !has_been_visible;
+Sprite * request_entity_sprite(EntityType type)
+{
+    switch (type) {
+    case EntityType::bat_blue: return RequestSprite("data/bat_blue.png");
+    case EntityType::bat_red: return RequestSprite("data/bat_red.png");
+    case EntityType::slime_blue: return RequestSprite("data/slime_blue.png");
+    case EntityType::ghost: return RequestSprite("data/ghost.png");
+    case EntityType::skeleton_white: return RequestSprite("data/skeleton_white.png");
+    default: assert(!"Unrecognized entity type");
     }
+    return NULL;
+}
 
-    void move()
-    {
-        if (is_inactive()) return;
-
-        if (type == EntityType::ghost) {
-            int player_dist = hex_dist_l2sq(s, t, player_s, player_t);
-            int player_prev_dist = hex_dist_l2sq(s, t, player_prev_s, player_prev_t);
+// Requests sprites for the enemy types on the current map only.
+void request_map_sprites()
+{
+    for (auto& e : game->entities) {
+        Sprite *& sprite = entity_sprites[static_cast<int>(e.type)];
+        if (!sprite) sprite = request_entity_sprite(e.type);
 
-            if (player_dist > player_prev_dist) {
-                hiding = false;
-            } else if (player_dist < player_prev_dist) {
-                hiding = true;
-            }
+        // Only these telegraph their moves.
+        if (e.type == EntityType::bat_blue || e.type == EntityType::bat_red || e.type == EntityType::slime_blue) {
+            FOR(d,NDIRS) {
+                if (telegraph_arrows[d]) continue;
 
-            if (hiding) return;
-        }
+                std::string path = "data/telegraph_arrow_";
+                path.push_back('0' + d);
+                path += ".png";
 
-        if (moveCooldown > 0) {
-            --moveCooldown;
-            return;
+                telegraph_arrows[d] = RequestSprite(path);
+            }
         }
+    }
+}
 
-        int move_dir = -1;
-
-        if (type == EntityType::bat_blue || type == EntityType::bat_red || type == EntityType::slime_blue) {
-            move_dir = prep_dir;
-            prep_dir = -1;
-        } else if (type == EntityType::skeleton_white || type == EntityType::ghost) {
-            // If we can't get closer to the player's current or previous position, prefer standing still.
-            auto best_key = make_tuple(
-                    hex_dist(s, t, player_s, player_t),
-                    hex_dist(s, t, player_prev_s, player_prev_t),
-                    0);
+// Frame snapshots
+//
+// Everything render() needs, copied out of the game after each change.
+// Sprites are referenced but only ever touched on the main thread.
+struct SnapTile
+{
+    int s, t;
+    Sprite * spr;
+    uint8_t brightness;
+};
 
-            // If all our desired moves are blocked, then instead of standing still,
-            // bump whichever tile we'd most like to be empty.
-            auto bump_key = best_key;
-            int bump_dir = -1;
+struct FrameSnapshot
+{
+    // Bumped by warp() and restart_map(), and by every turn played.
+    long world = 0;
+    long turn = 0;
 
-            FOR(d,NDIRS) {
-                int new_s = s + DIR_DS[d];
-                int new_t = t + DIR_DT[d];
-
-                // Always hit player when possible
-                if (player_s == new_s && player_t == new_t) {
-                    move_dir = d;
-                    break;
-                }
-
-                auto cur_key = make_tuple(
-                        hex_dist(new_s, new_t, player_s, player_t),
-                        hex_dist(new_s, new_t, player_prev_s, player_prev_t),
-                        dir_deviation(momentum_dir, d));
-
-                if (cur_key < bump_key) {
-                    bump_key = cur_key;
-                    bump_dir = d;
-                }
-
-                if (is_tile_blocking(new_s, new_t) || Entity::is_at(new_s, new_t)) continue;
-
-                if (cur_key < best_key) {
-                    best_key = cur_key;
-                    move_dir = d;
-                }
-            }
+    std::vector<SnapTile> tiles;
 
-            if (move_dir == -1) move_dir = bump_dir;
-        }
+    // Indexed like game->entities, for Animations.
+    std::vector<Entity> entities;
+    std::vector<char> entity_shown;
 
-        if (move_dir == -1) return;
+    Sprite * entity_sprites[NENTITY_TYPES];
+    Sprite * telegraph_arrows[NDIRS];
 
-        momentum_dir = move_dir;
+    int player_s=0, player_t=0;
+    Player player;
+};
 
-        int target_s = s + DIR_DS[move_dir];
-        int target_t = t + DIR_DT[move_dir];
+// Three buffers: the simulation fills snapshots[snap_back], the main thread
+// draws snapshots[snap_front], and the newest finished one waits in between.
+// Neither side ever waits for the other to finish with a buffer.
+FrameSnapshot snapshots[3];
+int snap_back = 0, snap_ready = 1, snap_front = 2;
+bool snap_fresh = false;
+
+std::mutex render_mu;
+
+// Key presses from the main thread, for the simulation thread to play.
+std::mutex input_mu;
+std::condition_variable input_cv;
+std::vector<SDL_Event> input_queue;
+bool sim_wakeup = false;
+bool sim_stopping = false;
+
+// Input latency
+//
+// A key press that plays a turn is stamped with when SDL queued it and tagged
+// with the turn. The main thread matches it to the first frame it presents
+// that shows that turn, and the gap between the two goes into input_latency.
+// The overlay shows it as it goes. Native builds print the whole histogram
+// at exit, so no I/O lands in the frames being timed.
+int const LATENCY_NBUCKETS = 250;
+double const LATENCY_BUCKET_MS = 1.0;
+
+struct LatencyHistogram
+{
+    // The last bucket also holds everything slower.
+    long counts[LATENCY_NBUCKETS] = {};
+    long n = 0;
+    double max_ms = 0;
 
-        bool moveFailed = false;
+    void add(double ms)
+    {
+        int b = std::min(LATENCY_NBUCKETS - 1, std::max(0, static_cast<int>(ms / LATENCY_BUCKET_MS)));
+        ++counts[b];
+        ++n;
+        max_ms = std::max(max_ms, ms);
+    }
 
-        if (is_tile_blocking(target_s, target_t) || Entity::is_at(target_s, target_t)) {
-            tweener.ease_bump_px(hex_to_pixel(s, t), hex_to_pixel(target_s, target_t));
-            moveFailed = true;
-        } else if (player_s == target_s && player_t == target_t) {
-            tweener.ease_bump_px(hex_to_pixel(s, t), hex_to_pixel(target_s, target_t));
-            player_be_hit();
-        } else {
-            tweener.ease_move_px(hex_to_pixel(s, t), hex_to_pixel(target_s, target_t));
-            s = target_s;
-            t = target_t;
+    // The upper edge of the bucket holding the pth fraction of samples.
+    double percentile(double p) const
+    {
+        long want = std::max(1L, static_cast<long>(ceil(p * n)));
+        long seen = 0;
+        FOR(b,LATENCY_NBUCKETS) {
+            seen += counts[b];
+            if (seen >= want) return std::min(max_ms, (b + 1) * LATENCY_BUCKET_MS);
         }
+        return max_ms;
+    }
 
-        if (!moveFailed) {
-            moveCooldown = moveCooldownMax;
+    void print() const
+    {
+        std::printf("input latency: %ld presses, p50 %.0f ms, p90 %.0f ms, p99 %.0f ms, max %.1f ms\n",
+                n, percentile(0.5), percentile(0.9), percentile(0.99), max_ms);
+        FOR(b,LATENCY_NBUCKETS) {
+            if (!counts[b]) continue;
+            std::printf("  %5.0f ms%s %6ld\n", b * LATENCY_BUCKET_MS, b == LATENCY_NBUCKETS - 1 ? "+" : " ", counts[b]);
         }
     }
+};
 
-    void think()
-    {
-        if (is_inactive()) return;
+struct PlayedInput
+{
+    long turn;
+    // Performance counter.
+    Uint64 pressed;
+};
 
-        if (thinkCooldown > 0) {
-            --thinkCooldown;
-            return;
-        }
-        thinkCooldown = thinkCooldownMax;
+// Played but not yet in a snapshot the renderer took. Guarded by render_mu.
+std::vector<PlayedInput> pending_inputs;
+// Main thread: shown by the frame being drawn.
+std::vector<PlayedInput> inputs_on_screen;
+LatencyHistogram input_latency;
 
-        if (type == EntityType::bat_blue || type == EntityType::bat_red) {
-            int num_open_dirs = 0;
-            int open_dirs[NDIRS];
+long world_serial = 0;
+long turn_serial = 0;
 
-            FOR(d,NDIRS) {
-                int target_s = s + DIR_DS[d];
-                int target_t = t + DIR_DT[d];
+bool should_render_tile(int s, int t)
+{
+    return cheat_vis || game->explored(s, t);
+}
 
-                if (!is_tile_blocking(target_s, target_t)) {
-                    open_dirs[num_open_dirs++] = d;
-                }
-            }
+// Light from the map's torches, plus the player's own, which is how far they
+// see clearly. Explored tiles out of all light are still drawn, dimly.
+int const PLAYER_SIGHT_RADIUS = 6;
+int const MIN_BRIGHTNESS = 80;
+int const BRIGHTNESS_PER_LIGHT = 32;
 
-            if (num_open_dirs == 0) return;
+LightMap lights;
+int player_light = -1;
+long lights_world = -1;
 
-            int i = rand() % num_open_dirs;
-            prep_dir = open_dirs[i];
-        } else if (type == EntityType::slime_blue) {
-            prep_dir = 3 * parity;
-            parity = (parity+1)%2;
-        }
+void update_lights()
+{
+    if (lights_world != world_serial) {
+        lights.reset();
+        player_light = lights.add(game->player_s, game->player_t, PLAYER_SIGHT_RADIUS);
+        lights_world = world_serial;
     }
+    lights.move(player_light, game->player_s, game->player_t);
+}
 
-    bool is_hittable()
-    {
-        if (type == EntityType::ghost && hiding) return false;
-        return true;
-    }
+// Simulation thread: copies the game out for the renderer.
+void publish_snapshot()
+{
+    FrameSnapshot & snap = snapshots[snap_back];
 
-    void be_hit()
-    {
-        is_dead = true;
-    }
+    snap.world = world_serial;
+    snap.turn = turn_serial;
 
-    void render()
-    {
-        if (is_dead) return;
+    update_lights();
 
-        // main sprite
-        auto [ x_px, y_px ] = pixel_to_screen(tweener.get_pos_px());
+    snap.tiles.clear();
+    MapData const & map = game->map();
+    FOR(i,map.ncells()) {
+        Tile tile = map.tiles[i];
+        if (tile.type == TileType::none) continue;
 
-        if (!should_render_tile(s,t)) return;
+        int s = map.s_of(i);
+        int t = map.t_of(i);
 
-        int frame = 0;
-        if (moveCooldown == 0) frame = frameTelegraph;
-        if (type == EntityType::ghost && hiding) frame = 1;
+        if (!should_render_tile(s,t)) continue;
 
-        SDL_Rect srcrect = { frame * sprite->w, 0, sprite->w, sprite->h };
-        SDL_Rect dstrect = { x_px - sprite->w/2, y_px - sprite->h/2, sprite->w, sprite->h };
-        CHECK_SDL(SDL_RenderCopy(ren, sprite->tex.get(), &srcrect, &dstrect));
+        Sprite * spr = NULL;
+        switch (tile.type) {
+        case TileType::floor: spr = tile_floor; break;
+        case TileType::wall: spr = tile_wall; break;
+        case TileType::door: spr = tile_door[tile.rotation]; break;
+        case TileType::none: break;
+        }
+        // none was skipped above, so this is a corrupt tile type. Note it and draw the rest.
+        if (!spr) {
+            if (telemetry) telemetry->push(TelemetryType::bad_tile, 0, s, t);
+            continue;
+        }
+        int brightness = std::min(255, MIN_BRIGHTNESS + BRIGHTNESS_PER_LIGHT * lights.level[i]);
+        snap.tiles.push_back({ s, t, spr, static_cast<uint8_t>(brightness) });
+    }
 
-        // telegraph arrow
-        int tile_x_px = x_px - tile_floor_w/2;
-        int tile_y_px = y_px - tile_floor_h/2;
+    snap.entities = game->entities;
+    snap.entity_shown.resize(snap.entities.size());
+    FOR(i,static_cast<int>(snap.entities.size())) {
+        Entity const & e = snap.entities[i];
+        snap.entity_shown[i] = should_render_tile(e.s, e.t);
+    }
 
-        if (prep_dir != -1) {
-            assert(0 <= prep_dir && prep_dir < NDIRS);
-            int xoff = 0, yoff = 0;
+    std::copy(entity_sprites, entity_sprites + NENTITY_TYPES, snap.entity_sprites);
+    std::copy(telegraph_arrows, telegraph_arrows + NDIRS, snap.telegraph_arrows);
 
-            switch (prep_dir) {
-            case 0: xoff = 70; yoff = 34; break;
-            case 1: xoff = 52; yoff =  3; break;
-            case 2: xoff = 14; yoff =  2; break;
-            case 3: xoff = -6; yoff = 34; break;
-            case 4: xoff = 15; yoff = 65; break;
-            case 5: xoff = 52; yoff = 64; break;
-            }
+    snap.player_s = game->player_s;
+    snap.player_t = game->player_t;
+    snap.player = game->player;
 
-            dstrect = { tile_x_px + xoff, tile_y_px + yoff, telegraph_arrows[prep_dir]->w, telegraph_arrows[prep_dir]->h };
-            CHECK_SDL(SDL_RenderCopy(ren, telegraph_arrows[prep_dir]->tex.get(), NULL, &dstrect));
-        }
+    {
+        std::lock_guard<std::mutex> lock(render_mu);
+        std::swap(snap_back, snap_ready);
+        snap_fresh = true;
     }
+    wake_renderer();
+}
 
-    void init()
-    {
-        switch (type) {
-        case EntityType::bat_blue: {
-            sprite = sprites.at("data/bat_blue.png").get();
-            thinkCooldownMax = 1;
-            break;
-        }
-        case EntityType::bat_red: {
-            sprite = sprites.at("data/bat_red.png").get();
-            break;
-        }
-        case EntityType::slime_blue: {
-            sprite = sprites.at("data/slime_blue.png").get();
-            thinkCooldownMax = 1;
-            break;
-        }
-        case EntityType::ghost: {
-            sprite = sprites.at("data/ghost.png").get();
-            break;
-        }
-        case EntityType::skeleton_white: {
-            sprite = sprites.at("data/skeleton_white.png").get();
-            moveCooldownMax = 1;
-            frameTelegraph = 1;
-            break;
-        }
-        default: assert(!"Unrecognized entity type");
-        }
+// Main thread: switches to the newest snapshot, if there is one.
+bool take_snapshot()
+{
+    std::lock_guard<std::mutex> lock(render_mu);
+    if (!snap_fresh) return false;
+    std::swap(snap_front, snap_ready);
+    snap_fresh = false;
+
+    long shown_turn = snapshots[snap_front].turn;
+    auto shown = std::stable_partition(BEND(pending_inputs), [&](PlayedInput const & in) { return in.turn <= shown_turn; });
+    inputs_on_screen.insert(inputs_on_screen.end(), pending_inputs.begin(), shown);
+    pending_inputs.erase(pending_inputs.begin(), shown);
+    return true;
+}
 
-        // Reasoning behind these values:
-        // 0. On the beat an enemy becomes visible, it shouldn't move.
-        // 1. On the next beat, it _still_ shouldn't move, but it's OK if it preps.
-        // 2. The beat after that, move is OK.
-        // This way the player has 2 beats to react to newly-visible enemies.
-        //
-        // If thinkCooldown=thinkCooldownMax, then blue bat wouldn't move until beat 3,
-        // which feels weird.
-        moveCooldown = moveCooldownMax;
-        thinkCooldown = 0;
+// Main thread: call right after presenting a frame.
+void note_presented()
+{
+    if (inputs_on_screen.empty()) return;
 
-        tweener.set_pos_px(hex_to_pixel(s, t));
+    // The render benchmark waits on purpose, so what it would measure means nothing.
+    if (render_bench) {
+        inputs_on_screen.clear();
+        return;
     }
 
-    std::tuple<int, int, int>
-    priority_key()
-    {
-        return make_tuple(
-            hex_dist_l2sq(s, t, player_s, player_t),
-            t,
-            s);
+    Uint64 now = SDL_GetPerformanceCounter();
+    for (auto& in : inputs_on_screen) {
+        double ms = seconds_between(in.pressed, now) * 1000;
+        input_latency.add(ms);
+        if (telemetry) telemetry->push(TelemetryType::input_latency, static_cast<int>(in.turn), static_cast<int>(ms * 1000));
     }
+    inputs_on_screen.clear();
+}
 
-    static void load_textures()
-    {
-        LoadSprite("data/bat_blue.png");
-        LoadSprite("data/bat_red.png");
-        LoadSprite("data/slime_blue.png");
-        LoadSprite("data/ghost.png", 2);
-        LoadSprite("data/skeleton_white.png", 2);
-
-        FOR(d,NDIRS) {
-            std::string path = "data/telegraph_arrow_";
-            path.push_back('0' + d);
-            path += ".png";
-
-            LoadSprite(path.c_str());
-            telegraph_arrows[d] = sprites[path].get();
-        }
-    }
+// Wakes the main thread if it's waiting for events, so it draws again.
+void wake_renderer()
+{
+    SDL_Event e;
+    memset(&e, 0, sizeof(e));
+    e.type = SDL_USEREVENT;
+    SDL_PushEvent(&e);
+}
 
-    static EntityType deserialize_type(std::string const & type)
+void wake_simulation()
+{
     {
-        if (type == "enemy_bat_blue") return EntityType::bat_blue;
-        if (type == "enemy_bat_red") return EntityType::bat_red;
-        if (type == "enemy_slime_blue") return EntityType::slime_blue;
-        if (type == "enemy_ghost") return EntityType::ghost;
-        if (type == "enemy_skeleton_white") return EntityType::skeleton_white;
-        assert(!"Unrecognized entity type");
-        return EntityType::none;
+        std::lock_guard<std::mutex> lock(input_mu);
+        sim_wakeup = true;
     }
+    input_cv.notify_one();
+}
 
-    static std::vector<unique_ptr<Entity>> entities;
+// Turns played on the current floor, for undo.
+TurnJournal journal(256);
 
-    static std::vector<Entity*> prioritized;
+// Map switching
+//
+// New games are prepared by the loader in the background while the current one
+// stays on screen, then swapped in whole between events. Floors left behind go
+// into the floor cache, and warping back to one resumes it instead.
+unique_ptr<WorldLoader> loader;
 
-    static void move_enemies()
-    {
-        prioritized.clear();
-        for (auto& e : entities) {
-            prioritized.push_back(e.get());
-        }
-        sort(BEND(prioritized), [](Entity * e1, Entity * e2) {
-            return e1->priority_key() < e2->priority_key();
-        });
+size_t const FLOOR_CACHE_BUDGET_BYTES = 64 << 20;
+FloorCache floors(FLOOR_CACHE_BUDGET_BYTES);
 
-        for (auto& e : prioritized) {
-            e->move();
-        }
-        for (auto& e : prioritized) {
-            e->think();
-        }
+// The map warped to but not yet swapped in, if any.
+std::string pending_warp;
 
-        // Wake visible enemies AFTER movement,
-        // so that they don't start moving instantly when seen.
-        wake_visible();
-    }
+// Swaps in the game for pending_warp if it's ready. Returns whether it did.
+bool finish_warp()
+{
+    if (pending_warp.empty()) return false;
 
-    static void wake_visible()
-    {
-        for (auto& e : entities) {
-            if (!e->has_been_visible && is_visible.find(make_tuple(e->s, e->t)) != is_visible.end()) {
-                e->has_been_visible = true;
-            }
-        }
-    }
+    // Warping to the current map restarts it, so never resume that one.
+    bool restart = pending_warp == game->map_path();
 
-    static void render_enemies()
-    {
-        for (auto& e : entities) {
-            e->render();
-        }
-    }
+    GameState next;
+    bool resumed = !restart && floors.take(pending_warp, next);
+    if (!resumed && !loader->take(pending_warp, next)) return false;
+    pending_warp.clear();
 
-    static Entity * get_at(int s, int t)
-    {
-        for (auto& e : entities) {
-            if (!e->is_dead && e->s == s && e->t == t) {
-                return e.get();
-            }
-        }
-        return NULL;
+    // Random maps are different every time; there's no going back to one.
+    if (!restart && the_game.map_path() != "random") {
+        floors.put(std::move(the_game));
     }
+    the_game = std::move(next);
+    journal.clear();
 
-    static bool is_at(int s, int t)
-    {
-        return get_at(s, t) != NULL;
-    }
-};
+    request_map_sprites();
+    ++world_serial;
 
-std::vector<unique_ptr<Entity>> Entity::entities;
-std::vector<Entity*> Entity::prioritized;
+    // Have a fresh copy ready again, so restarting is instant too.
+    if (!resumed) loader->preload(game->map_path(), game->prng());
+    return true;
+}
 
-void move_player(int dir)
+void warp(std::string const & map_path)
 {
-    player_prev_s = player_s;
-    player_prev_t = player_t;
+    pending_warp = map_path;
+    loader->preload(map_path, game->prng());
+    finish_warp();
+}
 
-    int ds = 0, dt = 0;
-    if (dir != -1) {
-        ds = DIR_DS[dir];
-        dt = DIR_DT[dir];
-    }
-    int target_s = player_s + ds;
-    int target_t = player_t + dt;
+void restart_map()
+{
+    warp(game->map_path());
+}
 
-    auto i = tiles.find(make_pair(target_s,target_t));
-    if (i == tiles.end()) return;
+// Quick save and load, of the floor being played.
+const char * const SAVE_PATH = "save.bin";
 
-    if (i->second.type == TileType::floor) {
-        // try to attack enemy there, if any
-        Entity * e = Entity::get_at(target_s, target_t);
-        if (e) {
-            if (e->is_hittable()) {
-                e->be_hit();
-            }
-        } else {
-            // otherwise move
-            player_s = target_s;
-            player_t = target_t;
-        }
-    } else if (i->second.type == TileType::door) {
-        // open the door
-        Tile new_tile;
-        new_tile.type = TileType::floor;
-        tiles[make_pair(target_s,target_t)] = new_tile;
-    } else if (i->second.type == TileType::wall) {
-        // TODO: try to dig it
+void quick_save()
+{
+    if (save_game(the_game, SAVE_PATH)) {
+        std::printf("saved to %s\n", SAVE_PATH);
+    } else {
+        std::perror(SAVE_PATH);
     }
+}
 
-    compute_visibility_plus();
+void quick_load()
+{
+    if (!load_game(SAVE_PATH, the_game)) {
+        std::printf("couldn't load %s\n", SAVE_PATH);
+        return;
+    }
+    pending_warp.clear();
+    journal.clear();
+    request_map_sprites();
+    ++world_serial;
+}
 
-    Entity::move_enemies();
+// Wakes the simulation when the loader has a game ready.
+void on_world_ready()
+{
+    wake_simulation();
 }
 
-struct MapBuilder
+void play_turn(int dir, Uint64 pressed)
 {
-    int player_s=0, player_t=0;
-    json tiles = json::array();
-    json entities = json::array();
+    // Doors opened this turn update the lights, so they must be for this world.
+    update_lights();
+    journal.play(dir);
+    ++turn_serial;
 
-    void player(int s, int t)
-    {
-        player_s = s;
-        player_t = t;
-    }
+    std::lock_guard<std::mutex> lock(render_mu);
+    pending_inputs.push_back({ turn_serial, pressed });
+}
 
-    void tile(int s, int t, const char * type, int rotation = 0)
-    {
-        tiles.push_back({ { "s", s }, { "t", t }, { "type", type }, { "rotation", rotation } });
-    }
+void undo_turn()
+{
+    if (!journal.undo(1)) return;
+    // Tweens only play forwards, so jump straight to the earlier state.
+    ++world_serial;
+    std::printf("undo: %d turns left, journal holds %zu bytes\n", journal.size(), journal.bytes());
+}
 
-    void entity(int s, int t, const char * type)
-    {
-        entities.push_back({ { "s", s }, { "t", t }, { "type", type } });
+// Simulation thread: handles one event. Returns whether anything on screen changed.
+std::atomic<bool> quitRequested(false);
+bool handle_event(SDL_Event const & e)
+{
+    if (e.type == SDL_QUIT) {
+        quitRequested = true;
     }
 
-    void hex_room(int min_s, int min_t, int s_len, int t_len, int trim_min, int trim_max)
-    {
-        int max_s = min_s + s_len;
-        int max_t = min_t + t_len;
+    if (e.type != SDL_KEYDOWN) return false;
 
-        FR(s, min_s, max_s+1) {
-            FR(t, min_t, max_t+1) {
-                int slack_min = (s - min_s + t - min_t) - trim_min;
-                int slack_max = (max_s - s + max_t - t) - trim_max;
+    // When SDL queued the key, on the performance counter. Event timestamps
+    // are only in milliseconds, so take the time since then off the counter.
+    Uint32 queued_ms = std::min<Uint32>(SDL_GetTicks() - e.key.timestamp, 1000);
+    Uint64 pressed = SDL_GetPerformanceCounter() - queued_ms * SDL_GetPerformanceFrequency() / 1000;
 
-                if (slack_min < 0 || slack_max < 0) continue;
+    if (e.key.keysym.sym == SDLK_ESCAPE) {
+        quitRequested = true;
+    }
+    if (e.key.keysym.sym == SDLK_BACKSPACE) {
+        restart_map();
+    }
 
-                const char * type = "wall";
-                if (min_s < s && s < max_s && min_t < t && t < max_t && slack_min > 0 && slack_max > 0) {
-                    type = "floor";
-                }
+    // Movement:
+    //  i o
+    // j   ;
+    //  k l
+    if (e.key.keysym.sym == SDLK_SEMICOLON) {
+        play_turn(0, pressed);
+    }
+    if (e.key.keysym.sym == SDLK_o) {
+        play_turn(1, pressed);
+    }
+    if (e.key.keysym.sym == SDLK_i) {
+        play_turn(2, pressed);
+    }
+    if (e.key.keysym.sym == SDLK_j) {
+        play_turn(3, pressed);
+    }
+    if (e.key.keysym.sym == SDLK_k) {
+        play_turn(4, pressed);
+    }
+    if (e.key.keysym.sym == SDLK_l) {
+        play_turn(5, pressed);
+    }
+    if (e.key.keysym.sym == SDLK_PERIOD) {
+        play_turn(-1, pressed);
+    }
 
-                tile(s, t, type);
-            }
-        }
+    if (e.key.keysym.sym == SDLK_u) {
+        undo_turn();
     }
 
-    json make_json()
-    {
-        json j;
+    // Maps
+    if (e.key.keysym.sym == SDLK_1) {
+        warp("data/map_bat.json");
+    } else if (e.key.keysym.sym == SDLK_2) {
+        warp("data/map_slime.json");
+    } else if (e.key.keysym.sym == SDLK_3) {
+        warp("data/map_skeleton.json");
+    } else if (e.key.keysym.sym == SDLK_4) {
+        warp("data/map_skeleton_line.json");
+    } else if (e.key.keysym.sym == SDLK_5) {
+        warp("data/map_proto1.json");
+    } else if (e.key.keysym.sym == SDLK_6) {
+        warp("data/map_proto2.json");
+    } else if (e.key.keysym.sym == SDLK_7) {
+        warp("data/map_mix.json");
+    } else if (e.key.keysym.sym == SDLK_8) {
+        warp("data/map_untitled.json");
+    } else if (e.key.keysym.sym == SDLK_0) {
+        warp("random");
+    }
 
-        j["player_s"] = player_s;
-        j["player_t"] = player_t;
-        j["tiles"] = tiles;
-        j["entities"] = entities;
+    // Saves
+    if (e.key.keysym.sym == SDLK_F5) {
+        quick_save();
+    }
+    if (e.key.keysym.sym == SDLK_F9) {
+        quick_load();
+    }
 
-        return j;
+    // Cheats
+    if (e.key.keysym.sym == SDLK_v) {
+        cheat_vis = !cheat_vis;
     }
-};
 
-json random_map_json()
-{
-    MapBuilder b;
-
-    b.hex_room(0, -6, 7, 6, 3, 3);
-    b.hex_room(3, -12, 7, 6, 3, 3);
-
-    b.hex_room(4, -3, 7, 6, 3, 3);
-    b.hex_room(7, -9, 7, 6, 3, 3);
-    b.hex_room(10, -15, 7, 6, 3, 3);
-
-    b.hex_room(11, -6, 7, 6, 3, 3);
-    b.hex_room(14, -12, 7, 6, 3, 3);
-
-    b.tile(5, -6, "door", 0);
-    b.tile(7, -5, "door", 1);
-    b.tile(5, -1, "door", 2);
-
-    b.tile(10, -10, "door", 1);
-    b.tile(12, -9, "door", 0);
-    b.tile(11, -2, "door", 1);
-    b.tile(12, -4, "door", 2);
-
-    b.tile(15, -10, "door", 2);
-    b.tile(16, -6, "door", 0);
-
-    b.player(3, -3);
-
-    int const NROOM = 6;
-    int const PER_ROOM = 4;
-
-    std::vector<const char *> cohort = {
-        "enemy_skeleton_white",
-        "enemy_skeleton_white",
-        "enemy_skeleton_white",
-        "enemy_skeleton_white",
-        "enemy_skeleton_white",
-        "enemy_skeleton_white",
-        "enemy_slime_blue",
-        "enemy_slime_blue",
-        "enemy_slime_blue",
-        "enemy_slime_blue",
-
-        "enemy_bat_blue",
-        "enemy_bat_blue",
-        "enemy_bat_blue",
-        "enemy_bat_blue",
-        "enemy_bat_blue",
-        "enemy_bat_red",
-        "enemy_ghost",
-        "enemy_ghost",
-        "enemy_ghost",
-        "enemy_ghost",
-
-        "enemy_skeleton_white",
-        "enemy_skeleton_white",
-        "enemy_ghost",
-        "enemy_ghost",
-        };
-    assert(cohort.size() >= NROOM*PER_ROOM);
-
-    std::shuffle(BEND(cohort), prng);
-
-    int s0[NROOM] = { 3, 4, 7, 10, 11, 14 };
-    int t0[NROOM] = { -12, -3, -9, -15, -6, -12 };
-
-    FOR(i,NROOM) {
-        std::vector<const char *> contents;
-        FOR(j,PER_ROOM) {
-            contents.push_back(cohort.back());
-            cohort.pop_back();
-        }
+    return true;
+}
+
+// Plays whatever input is waiting and publishes the result, all on this
+// thread: for the web build and the render benchmark, which have no
+// simulation thread.
+void update()
+{
+    bool changed = false;
 
-        b.entity(s0[i]+3, t0[i]+2, contents[0]);
-        b.entity(s0[i]+5, t0[i]+2, contents[1]);
-        b.entity(s0[i]+2, t0[i]+4, contents[2]);
-        b.entity(s0[i]+4, t0[i]+4, contents[3]);
+    SDL_Event e;
+    while (SDL_PollEvent(&e)) {
+        changed |= handle_event(e);
     }
+    changed |= finish_warp();
 
-    return b.make_json();
+    if (changed) publish_snapshot();
 }
 
-std::string current_map_path;
+#ifndef __EMSCRIPTEN__
+std::thread sim_thread;
 
-void load_map()
+void sim_main()
 {
-    json j;
-    if (current_map_path == "random") {
-        j = random_map_json();
-    } else {
-        std::ifstream i(current_map_path);
-        i >> j;
-    }
-
-    tiles.clear();
-    for (auto& rec : j["tiles"]) {
-        int s = rec["s"].get<int>();
-        int t = rec["t"].get<int>();
-        std::string type = rec["type"].get<std::string>();
-
-        Tile tile;
-        if (type == "wall") {
-            tile.type = TileType::wall;
-        } else if (type == "floor") {
-            tile.type = TileType::floor;
-        } else if (type == "door") {
-            tile.type = TileType::door;
-            tile.rotation = rec["rotation"].get<int>();
-        } else {
-            assert(!"Unrecognized tile type");
+    game = &the_game;
+    listener = &lights;
+    if (the_telemetry.is_running()) telemetry = &the_telemetry;
+
+    std::vector<SDL_Event> events;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(input_mu);
+            input_cv.wait_for(lock, std::chrono::milliseconds(IDLE_WAKEUP_MS),
+                [] { return sim_stopping || sim_wakeup || !input_queue.empty(); });
+            if (sim_stopping) break;
+            sim_wakeup = false;
+            events.swap(input_queue);
         }
 
-        tiles[make_pair(s,t)] = tile;
-    }
+        bool changed = false;
+        for (auto& e : events) {
+            changed |= handle_event(e);
+        }
+        events.clear();
+        changed |= finish_warp();
 
-    auto e_json = j.find("entities");
-    assert(e_json != j.end());
-    Entity::entities.clear();
-    for (auto& rec : *e_json) {
-        unique_ptr<Entity> e(new Entity);
-        e->s = rec["s"].get<int>();
-        e->t = rec["t"].get<int>();
+        if (changed) publish_snapshot();
+    }
+}
 
-        std::string type = rec["type"].get<std::string>();
-        e->type = Entity::deserialize_type(type);
-        e->init();
+void start_sim_thread()
+{
+    sim_thread = std::thread(sim_main);
+}
 
-        Entity::entities.push_back(std::move(e));
+void stop_sim_thread()
+{
+    {
+        std::lock_guard<std::mutex> lock(input_mu);
+        sim_stopping = true;
     }
+    input_cv.notify_one();
+    sim_thread.join();
+}
 
-    auto s_json = j.find("spawns");
-    if (s_json != j.end()) {
-        int n_spawns = s_json->size();
+// Main thread: hands key presses to the simulation, blocking for up to
+// wait_ms for the first event of any kind.
+void pump_events(Uint32 wait_ms)
+{
+    bool got_keys = false;
 
-        std::vector<const char *> cohort;
-        bool any_red_bat = false;
-        FOR(i,n_spawns) {
-            double pos = i / static_cast<double>(n_spawns);
+    SDL_Event e;
+    bool have = wait_ms > 0 ? SDL_WaitEventTimeout(&e, wait_ms) : SDL_PollEvent(&e);
+    while (have) {
+        if (e.type == SDL_QUIT) quitRequested = true;
+        if (e.type == SDL_KEYDOWN) {
+            std::lock_guard<std::mutex> lock(input_mu);
+            input_queue.push_back(e);
+            got_keys = true;
+        }
+        have = SDL_PollEvent(&e);
+    }
 
-            const char * etype = "enemy_skeleton_white";
-            if (pos < 0.25) {
-                etype = "enemy_ghost";
-            } else if (pos < 0.5) {
-                etype = "enemy_slime_blue";
-            } else if (pos < 0.75) {
-                etype = "enemy_bat_blue";
-                if (!any_red_bat) {
-                    etype = "enemy_bat_red";
-                    any_red_bat = true;
-                }
-            }
+    if (got_keys) input_cv.notify_one();
+}
+#endif
 
-            cohort.push_back(etype);
-        }
+// Main thread state
+Animations animations;
 
-        std::shuffle(BEND(cohort), prng);
+double deltaFrame_s;
+Uint32 prevFrame_ms;
 
-        for (auto& rec : *s_json) {
-            unique_ptr<Entity> e(new Entity);
-            e->s = rec["s"].get<int>();
-            e->t = rec["t"].get<int>();
+long drawn_world = -1;
+long drawn_turn = -1;
 
-            std::string type = cohort.back();
-            cohort.pop_back();
-            e->type = Entity::deserialize_type(type);
-            e->init();
+int camera_x_px;
+int camera_y_px;
 
-            Entity::entities.push_back(std::move(e));
-        }
-    }
+std::tuple<int, int> pixel_to_screen(std::tuple<int, int> pos)
+{
+    auto [ x_px, y_px ] = pos;
+    return make_tuple(x_px - camera_x_px, y_px - camera_y_px);
+}
 
-    player_s = j["player_s"].get<int>();
-    player_t = j["player_t"].get<int>();
+std::tuple<int, int> hex_to_screen(int s, int t)
+{
+    return pixel_to_screen(hex_to_pixel(s, t));
 }
 
-void snap_camera_to_player()
+double const CAMERA_TWEEN_SPEED = 10.0;
+
+void snap_camera_to_player(FrameSnapshot const & snap)
 {
-    auto [ player_x_px, player_y_px ] = hex_to_pixel(player_s, player_t);
+    auto [ player_x_px, player_y_px ] = hex_to_pixel(snap.player_s, snap.player_t);
 
     camera_x_px = player_x_px - ORIGIN_X_PX;
     camera_y_px = player_y_px - ORIGIN_Y_PX;
 }
 
-void reset_game()
+// Starts animating whatever changed between the last snapshot drawn and snap.
+void follow_snapshot(FrameSnapshot const & snap)
 {
-    load_map();
-    player_prev_s = player_s;
-    player_prev_t = player_t;
-    player.health = player.max_health;
-    snap_camera_to_player();
-
-    tile_has_been_visible.clear();
-    compute_visibility_plus();
-    Entity::wake_visible();
+    if (snap.world != drawn_world) {
+        animations.reset(snap.entities);
+        snap_camera_to_player(snap);
+    } else if (snap.turn != drawn_turn) {
+        animations.start_turn(snap.entities);
+    }
+    drawn_world = snap.world;
+    drawn_turn = snap.turn;
 }
 
-void warp_to_map(std::string map_path)
+// Advances the tweens and the camera by dt_s. Returns whether anything on
+// screen is still moving, which keeps frames coming.
+bool animate(FrameSnapshot const & snap, double dt_s)
 {
-    current_map_path = map_path;
-    reset_game();
-}
+    animations.advance(dt_s);
 
-bool quitRequested;
-void update()
-{
-    SDL_Event e;
-    while (SDL_PollEvent(&e)) {
-        if (e.type == SDL_QUIT) {
-            quitRequested = true;
-        }
+    auto [ player_x_px, player_y_px ] = hex_to_pixel(snap.player_s, snap.player_t);
 
-        if (e.type == SDL_KEYDOWN) {
-            if (e.key.keysym.sym == SDLK_ESCAPE) {
-                quitRequested = true;
-            }
-            if (e.key.keysym.sym == SDLK_BACKSPACE) {
-                reset_game();
-            }
+    int target_x_px = player_x_px - ORIGIN_X_PX;
+    int target_y_px = player_y_px - ORIGIN_Y_PX;
 
-            // Movement:
-            //  i o
-            // j   ;
-            //  k l
-            if (e.key.keysym.sym == SDLK_SEMICOLON) {
-                move_player(0);
-            }
-            if (e.key.keysym.sym == SDLK_o) {
-                move_player(1);
-            }
-            if (e.key.keysym.sym == SDLK_i) {
-                move_player(2);
-            }
-            if (e.key.keysym.sym == SDLK_j) {
-                move_player(3);
-            }
-            if (e.key.keysym.sym == SDLK_k) {
-                move_player(4);
-            }
-            if (e.key.keysym.sym == SDLK_l) {
-                move_player(5);
-            }
-            if (e.key.keysym.sym == SDLK_PERIOD) {
-                move_player(-1);
-            }
+    int old_x_px = camera_x_px, old_y_px = camera_y_px;
 
-            // Maps
-            if (e.key.keysym.sym == SDLK_1) {
-                warp_to_map("data/map_bat.json");
-            } else if (e.key.keysym.sym == SDLK_2) {
-                warp_to_map("data/map_slime.json");
-            } else if (e.key.keysym.sym == SDLK_3) {
-                warp_to_map("data/map_skeleton.json");
-            } else if (e.key.keysym.sym == SDLK_4) {
-                warp_to_map("data/map_skeleton_line.json");
-            } else if (e.key.keysym.sym == SDLK_5) {
-                warp_to_map("data/map_proto1.json");
-            } else if (e.key.keysym.sym == SDLK_6) {
-                warp_to_map("data/map_proto2.json");
-            } else if (e.key.keysym.sym == SDLK_7) {
-                warp_to_map("data/map_mix.json");
-            } else if (e.key.keysym.sym == SDLK_8) {
-                warp_to_map("data/map_untitled.json");
-            } else if (e.key.keysym.sym == SDLK_0) {
-                warp_to_map("random");
-            }
+    double alpha = exp(-dt_s * CAMERA_TWEEN_SPEED);
+    camera_x_px = static_cast<int>(round(alpha * camera_x_px + (1-alpha) * target_x_px));
+    camera_y_px = static_cast<int>(round(alpha * camera_y_px + (1-alpha) * target_y_px));
 
-            // Cheats
-            if (e.key.keysym.sym == SDLK_v) {
-                cheat_vis = !cheat_vis;
-            }
-        }
-    }
+    // The easing settles within a few pixels of the target and then stops changing,
+    // so "still moving" means it moved this frame (or no time passed to tell).
+    bool at_target = camera_x_px == target_x_px && camera_y_px == target_y_px;
+    bool moved = camera_x_px != old_x_px || camera_y_px != old_y_px;
+    bool camera_moving = moved || (dt_s == 0 && !at_target);
+
+    return camera_moving || animations.any_active();
 }
 
-void render()
+void render_entity(FrameSnapshot const & snap, Entity const & e, int pos_x_px, int pos_y_px)
 {
-    //// update camera
-    {
-        auto [ player_x_px, player_y_px ] = hex_to_pixel(player_s, player_t);
+    if (e.is_dead) return;
+
+    // main sprite
+    auto [ x_px, y_px ] = pixel_to_screen(make_tuple(pos_x_px, pos_y_px));
+
+    Sprite * sprite = snap.entity_sprites[static_cast<int>(e.type)];
+    if (!sprite->tex) return;
+
+    int frame = 0;
+    if (e.moveCooldown == 0) frame = e.frameTelegraph;
+    if (e.type == EntityType::ghost && e.hiding) frame = 1;
+
+    SDL_Rect srcrect = { frame * sprite->w, 0, sprite->w, sprite->h };
+    SDL_Rect dstrect = { x_px - sprite->w/2, y_px - sprite->h/2, sprite->w, sprite->h };
+    CHECK_SDL(RenderCopy(ren, sprite->tex.get(), &srcrect, &dstrect));
+
+    // telegraph arrow
+    int tile_x_px = x_px - tile_floor->w/2;
+    int tile_y_px = y_px - tile_floor->h/2;
+
+    int prep_dir = e.prep_dir;
+    Sprite * const * arrows = snap.telegraph_arrows;
+    if (prep_dir != -1 && tile_floor->tex && arrows[prep_dir]->tex) {
+        assert(0 <= prep_dir && prep_dir < NDIRS);
+        int xoff = 0, yoff = 0;
+
+        switch (prep_dir) {
+        case 0: xoff = 70; yoff = 34; break;
+        case 1: xoff = 52; yoff =  3; break;
+        case 2: xoff = 14; yoff =  2; break;
+        case 3: xoff = -6; yoff = 34; break;
+        case 4: xoff = 15; yoff = 65; break;
+        case 5: xoff = 52; yoff = 64; break;
+        }
 
-        int target_x_px = player_x_px - ORIGIN_X_PX;
-        int target_y_px = player_y_px - ORIGIN_Y_PX;
+        dstrect = { tile_x_px + xoff, tile_y_px + yoff, arrows[prep_dir]->w, arrows[prep_dir]->h };
+        CHECK_SDL(RenderCopy(ren, arrows[prep_dir]->tex.get(), NULL, &dstrect));
+    }
+}
 
-        double alpha = exp(-deltaFrame_s * CAMERA_TWEEN_SPEED);
-        camera_x_px = static_cast<int>(round(alpha * camera_x_px + (1-alpha) * target_x_px));
-        camera_y_px = static_cast<int>(round(alpha * camera_y_px + (1-alpha) * target_y_px));
+void render_enemies(FrameSnapshot const & snap)
+{
+    FOR(i,animations.size()) {
+        if (!snap.entity_shown[i]) continue;
+        render_entity(snap, snap.entities[i], animations.pos_x_px[i], animations.pos_y_px[i]);
     }
+}
 
+void render(FrameSnapshot const & snap)
+{
     //// clear screen
     CHECK_SDL(SDL_SetRenderDrawColor(ren, 0, 0, 0, 255));
     CHECK_SDL(SDL_RenderClear(ren));
 
     //// draw tiles
-    for (auto& it : tiles) {
-        int s = it.first.first;
-        int t = it.first.second;
-        Tile tile = it.second;
+    for (auto& tile : snap.tiles) {
+        Sprite * spr = tile.spr;
+        if (!spr->tex) continue;
 
-        if (!should_render_tile(s,t)) continue;
+        auto [ x_px, y_px ] = hex_to_screen(tile.s, tile.t);
 
-        SDL_Texture * tex = NULL;
-        switch (tile.type) {
-        case TileType::floor: tex = tile_floor.get(); break;
-        case TileType::wall: tex = tile_wall.get(); break;
-        case TileType::door: tex = tile_door[tile.rotation].get(); break;
-        case TileType::none:
-            fprintf(stderr, "Tile at (%d,%d) has type = TileType::none\n", s, t);
-            assert(!"Render encountered TileType::none");
-            break;
-        }
-
-        auto [ x_px, y_px ] = hex_to_screen(s, t);
-
-        SDL_Rect dstrect = { x_px - tile_floor_w/2, y_px - tile_floor_h/2, tile_floor_w, tile_floor_h };
-        CHECK_SDL(SDL_RenderCopy(ren, tex, NULL, &dstrect));
+        SDL_Rect dstrect = { x_px - spr->w/2, y_px - spr->h/2, spr->w, spr->h };
+        CHECK_SDL(SDL_SetTextureColorMod(spr->tex.get(), tile.brightness, tile.brightness, tile.brightness));
+        CHECK_SDL(RenderCopy(ren, spr->tex.get(), NULL, &dstrect));
     }
 
     //// draw enemies
-    Entity::render_enemies();
+    render_enemies(snap);
 
     //// draw player
     {
-        auto [ player_x_px, player_y_px ] = hex_to_screen(player_s, player_t);
+        auto [ player_x_px, player_y_px ] = hex_to_screen(snap.player_s, snap.player_t);
         int player_w_px=64, player_h_px=64;
         CHECK_SDL(SDL_SetRenderDrawColor(ren, 255, 255, 255, 255));
         SDL_Rect rect = { player_x_px - player_w_px/2, player_y_px - player_h_px/2, player_w_px, player_h_px };
-        CHECK_SDL(SDL_RenderFillRect(ren, &rect));
+        CHECK_SDL(RenderFillRect(ren, &rect));
     }
 
     //// draw HUD
-    {
-        Sprite * heart_empty = sprites.at("data/heart_empty.png").get();
-        Sprite * heart_full = sprites.at("data/heart_full.png").get();
-
+    if (heart_empty->tex && heart_full->tex) {
         int xoff = 41;
         int yoff = 44;
-        FOR(i,player.max_health) {
+        FOR(i,snap.player.max_health) {
             Sprite * spr = heart_empty;
-            if (i < player.health) spr = heart_full;
+            if (i < snap.player.health) spr = heart_full;
 
             SDL_Rect dstrect = { xoff, yoff, spr->w, spr->h };
-            CHECK_SDL(SDL_RenderCopy(ren, spr->tex.get(), NULL, &dstrect));
+            CHECK_SDL(RenderCopy(ren, spr->tex.get(), NULL, &dstrect));
 
             xoff += spr->w + 11;
         }
@@ -1196,31 +1234,216 @@ void render()
     CHECK_SDL(SDL_SetRenderDrawColor(ren, 255, 255, 255, 255));
     char buf[256];
 
-    snprintf(buf, sizeof(buf), "S=%2d T=%2d", player_s, player_t);
+    snprintf(buf, sizeof(buf), "S=%2d T=%2d", snap.player_s, snap.player_t);
     DrawText(ren, font, buf, {255, 255, 255, 255}, 0, 0, NULL, NULL, TEXT_ALIGNH_LEFT);
 
-    snprintf(buf, sizeof(buf), "t=%.1lf ms", avgFrameTime_ms());
-    DrawText(ren, font, buf, {255, 255, 255, 255}, WIN_WIDTH, 0, NULL, NULL, TEXT_ALIGNH_RIGHT);
+    // Timings differ from run to run, so leave them out of benchmark frames.
+    if (!render_bench) {
+        snprintf(buf, sizeof(buf), "t=%.1lf ms, %ld missed", avgFrameTime_ms(), frame_pacer.missed);
+        DrawText(ren, font, buf, {255, 255, 255, 255}, WIN_WIDTH, 0, NULL, NULL, TEXT_ALIGNH_RIGHT);
 
-    SDL_RenderPresent(ren);
+        if (input_latency.n > 0) {
+            snprintf(buf, sizeof(buf), "input p50 %.0f ms, p90 %.0f ms", input_latency.percentile(0.5), input_latency.percentile(0.9));
+            DrawText(ren, font, buf, {255, 255, 255, 255}, WIN_WIDTH, FONT_HEIGHT, NULL, NULL, TEXT_ALIGNH_RIGHT);
+        }
+    }
 }
 
-Uint32 prevFrame_ms;
-void main_loop()
+// Main thread: draws one frame, if anything changed.
+void render_frame()
 {
     Uint32 thisFrame_ms = SDL_GetTicks();
     Uint32 deltaFrame_ms = thisFrame_ms - prevFrame_ms;
+    deltaFrame_s = frame_pacer.begin_frame();
+
+    if (take_snapshot()) {
+        follow_snapshot(snapshots[snap_front]);
+        frame_dirty = true;
+    }
+    FrameSnapshot const & snap = snapshots[snap_front];
+
+    UploadDecodedSprites();
+    bool moving = animate(snap, deltaFrame_s);
+
+    prevFrame_ms = thisFrame_ms;
+
+    // The web build is called back every animation frame regardless; just skip drawing.
+    if (!frame_dirty && !moving) return;
+
     accumTime(deltaFrame_ms);
-    deltaFrame_s = deltaFrame_ms / 1000.0;
+    frame_dirty = moving;
+    render(snap);
+    SDL_RenderPresent(ren);
+    note_presented();
+
+    if (!first_frame_reported) {
+        std::printf("first frame after %.1f ms\n", ms_since_startup());
+        first_frame_reported = true;
+    }
+    if (!startup_assets_reported && sprites_pending == 0) {
+        std::printf("startup assets ready after %.1f ms\n", ms_since_startup());
+        startup_assets_reported = true;
+    }
+
+#ifndef __EMSCRIPTEN__
+    frame_pacer.end_frame();
+#endif
+}
+
+#ifdef __EMSCRIPTEN__
+void main_loop()
+{
     update();
-    render();
+    render_frame();
+}
+#endif
 
-    prevFrame_ms = thisFrame_ms;
+#ifndef __EMSCRIPTEN__
+// Render benchmark
+//
+// main --render-bench [keys] [dump_frames]
+//
+// Plays keys through update(), one character per key press as handle_event
+// reads them ("@path" reads them from a file), and draws BENCH_FRAMES_PER_KEY
+// frames after each with the software renderer. The video driver is SDL's
+// dummy one unless SDL_VIDEODRIVER says otherwise, so no display is needed.
+// The game is seeded the same every run, and every frame waits for its
+// sprites, so runs draw the same frames.
+//
+// Prints one JSON line per frame: the time to draw and present it, its draw
+// calls and its texture switches, then a summary line. Frames listed in
+// dump_frames ("0,45,...") are also written to render_NNNN.png, to be
+// compared between commits.
+int const BENCH_FRAMES_PER_KEY = 30;
+double const BENCH_FRAME_S = 1.0 / TARGET_FPS;
+char const * const BENCH_DEFAULT_KEYS = "llkkk..k..k...;;..0llkkk";
+
+void dump_frame(int frame)
+{
+    sdl_ptr<SDL_Surface> surf(SDL_CreateRGBSurfaceWithFormat(0, WIN_WIDTH, WIN_HEIGHT, 32, SDL_PIXELFORMAT_RGBA32));
+    if (!surf) failSDL("SDL_CreateRGBSurfaceWithFormat");
+    CHECK_SDL(SDL_RenderReadPixels(ren, NULL, SDL_PIXELFORMAT_RGBA32, surf->pixels, surf->pitch));
+
+    char path[64];
+    snprintf(path, sizeof(path), "render_%04d.png", frame);
+    CHECK_IMG(IMG_SavePNG(surf.get(), path));
+}
+
+// Waits out a warp and any sprites still loading.
+void settle_for_bench()
+{
+    while (!pending_warp.empty() || sprites_pending > 0) {
+        update();
+        UploadDecodedSprites();
+        SDL_Delay(1);
+    }
+}
+
+int run_render_bench(std::string keys, std::vector<int> const & dump_frames)
+{
+    if (!keys.empty() && keys[0] == '@') {
+        std::ifstream in(keys.substr(1));
+        if (!in) {
+            std::perror(keys.c_str() + 1);
+            return 1;
+        }
+        keys.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    keys.erase(std::remove_if(BEND(keys), [](char c) { return isspace(c); }), keys.end());
+
+    ren = SDL_CreateRenderer(win, -1, SDL_RENDERER_SOFTWARE);
+    if (!ren) failSDL("SDL_CreateRenderer");
+
+    std::vector<double> frame_us;
+    long total_draws = 0, total_switches = 0;
+
+    // Step -1 is the map as it starts, before any key.
+    for (int step = -1; step < static_cast<int>(keys.size()); ++step) {
+        if (step >= 0) {
+            SDL_Event e;
+            memset(&e, 0, sizeof(e));
+            e.type = SDL_KEYDOWN;
+            e.key.keysym.sym = keys[step];
+            SDL_PushEvent(&e);
+            update();
+        }
+        settle_for_bench();
+
+        FOR(k,BENCH_FRAMES_PER_KEY) {
+            if (take_snapshot()) follow_snapshot(snapshots[snap_front]);
+            FrameSnapshot const & snap = snapshots[snap_front];
+            animate(snap, BENCH_FRAME_S);
+
+            int frame = frame_us.size();
+            draw_stats = DrawStats();
+
+            Uint64 start = SDL_GetPerformanceCounter();
+            render(snap);
+            double us = seconds_between(start, SDL_GetPerformanceCounter()) * 1e6;
+
+            if (std::count(BEND(dump_frames), frame)) dump_frame(frame);
+
+            start = SDL_GetPerformanceCounter();
+            SDL_RenderPresent(ren);
+            note_presented();
+            us += seconds_between(start, SDL_GetPerformanceCounter()) * 1e6;
+
+            frame_us.push_back(us);
+            total_draws += draw_stats.draws;
+            total_switches += draw_stats.texture_switches;
+            std::printf("{\"frame\":%d,\"step\":%d,\"tiles\":%zu,\"render_us\":%.1f,\"draws\":%d,\"texture_switches\":%d}\n",
+                    frame, step, snap.tiles.size(), us, draw_stats.draws, draw_stats.texture_switches);
+        }
+    }
+
+    int n = frame_us.size();
+    std::vector<double> sorted = frame_us;
+    std::sort(BEND(sorted));
+    double sum = 0;
+    for (double us : frame_us) sum += us;
+    std::printf("{\"frames\":%d,\"keys\":%zu,\"mean_us\":%.1f,\"p50_us\":%.1f,\"p95_us\":%.1f,\"max_us\":%.1f,"
+            "\"draws_per_frame\":%.1f,\"texture_switches_per_frame\":%.1f}\n",
+            n, keys.size(), sum / n, sorted[n/2], sorted[n * 95 / 100], sorted[n-1],
+            total_draws / static_cast<double>(n), total_switches / static_cast<double>(n));
+
+    loader.reset();
+    return 0;
 }
+#endif
 
-int main()
+int main(int argc, char ** argv)
 {
-    srand(time(NULL));
+    startup_counter = SDL_GetPerformanceCounter();
+
+#ifndef __EMSCRIPTEN__
+    render_bench = argc > 1 && std::string(argv[1]) == "--render-bench";
+    // An empty keys argument still takes the default, so frames can be dumped from it.
+    std::string bench_keys = argc > 2 && argv[2][0] ? argv[2] : BENCH_DEFAULT_KEYS;
+    std::vector<int> bench_dumps;
+    if (argc > 3) {
+        for (char const * p = argv[3]; *p; ) {
+            bench_dumps.push_back(atoi(p));
+            while (*p && *p != ',') ++p;
+            if (*p) ++p;
+        }
+    }
+    // A hint, so SDL_VIDEODRIVER in the environment still wins.
+    if (render_bench) SDL_SetHint(SDL_HINT_VIDEODRIVER, "dummy");
+#endif
+
+    game = &the_game;
+    game->prng.seed(render_bench ? 1 : time(NULL));
+
+#ifndef __EMSCRIPTEN__
+    // Not for the render benchmark: its writer thread would be timed too.
+    if (!render_bench) {
+        if (the_telemetry.start(TELEMETRY_PATH)) {
+            telemetry = &the_telemetry;
+        } else {
+            std::perror(TELEMETRY_PATH);
+        }
+    }
+#endif
     atexit(cleanup);
 
     if (SDL_Init(SDL_INIT_VIDEO) < 0) failSDL("SDL_Init");
@@ -1229,7 +1452,14 @@ int main()
     int flags = IMG_INIT_PNG;
     if ((IMG_Init(flags) & flags) != flags) failIMG("IMG_Init");
 
-    font = TTF_OpenFont("data/Vera.ttf", FONT_HEIGHT);
+    asset_pack.open(ASSET_PACK_PATH);
+
+    PackEntry const * font_entry = asset_pack.find(FONT_ASSET);
+    if (font_entry && font_entry->kind == PACK_KIND_FONT) {
+        font = TTF_OpenFontRW(SDL_RWFromConstMem(asset_pack.blob(*font_entry), font_entry->size), 1, FONT_HEIGHT);
+    } else {
+        font = TTF_OpenFont(FONT_ASSET, FONT_HEIGHT);
+    }
     if (!font) failTTF("TTF_OpenFont");
 
     win = SDL_CreateWindow("Hex Dance Dungeon",
@@ -1237,36 +1467,74 @@ int main()
         WIN_WIDTH, WIN_HEIGHT, SDL_WINDOW_SHOWN);
     if (!win) failSDL("SDL_CreateWindow");
 
-    ren = SDL_CreateRenderer(win, -1, 0);
-    if (!ren) failSDL("SDL_CreateRenderer");
+    // start loading textures; entity sprites are requested per map by warp()
+    start_decoders();
 
-    // load textures
-    tile_floor.reset(LoadTexture(ren, "data/tile_floor.png"));
-    CHECK_SDL(SDL_QueryTexture(tile_floor.get(), NULL, NULL, &tile_floor_w, &tile_floor_h));
-    tile_wall.reset(LoadTexture(ren, "data/tile_wall.png"));
+    tile_floor = RequestSprite("data/tile_floor.png");
+    tile_wall = RequestSprite("data/tile_wall.png");
 
-    tile_door[0].reset(LoadTexture(ren, "data/tile_door_0.png"));
-    tile_door[1].reset(LoadTexture(ren, "data/tile_door_1.png"));
-    tile_door[2].reset(LoadTexture(ren, "data/tile_door_2.png"));
+    tile_door[0] = RequestSprite("data/tile_door_0.png");
+    tile_door[1] = RequestSprite("data/tile_door_1.png");
+    tile_door[2] = RequestSprite("data/tile_door_2.png");
 
-    Entity::load_textures();
+    heart_empty = RequestSprite("data/heart_empty.png");
+    heart_full = RequestSprite("data/heart_full.png");
 
-    LoadSprite("data/heart_empty.png");
-    LoadSprite("data/heart_full.png");
+    // init game: the first map is loaded up front, since there's nothing to show
+    // until it's ready. The built-in ones are then prepared in the background.
+    loader.reset(new WorldLoader(on_world_ready));
 
-    // init game
     warp_to_map("random");
+    request_map_sprites();
+    ++world_serial;
+    listener = &lights;
+    publish_snapshot();
+
+    for (auto& path : BUILTIN_MAPS) {
+        loader->preload(path, game->prng());
+    }
 
     // IO loop
+#ifndef __EMSCRIPTEN__
+    if (render_bench) return run_render_bench(bench_keys, bench_dumps);
+#endif
+
+    ren = SDL_CreateRenderer(win, -1, SDL_RENDERER_PRESENTVSYNC);
+    if (!ren) failSDL("SDL_CreateRenderer");
+
     prevFrame_ms = SDL_GetTicks();
-    quitRequested = false;
 
 #ifdef __EMSCRIPTEN__
+    frame_pacer.start(true);
+
     emscripten_set_main_loop(main_loop, 0, 0);
 #else
+    SDL_RendererInfo ren_info;
+    CHECK_SDL(SDL_GetRendererInfo(ren, &ren_info));
+    frame_pacer.start(ren_info.flags & SDL_RENDERER_PRESENTVSYNC);
+
+    // From here on the game belongs to the simulation thread.
+    start_sim_thread();
+
     while (!quitRequested) {
-        main_loop();
+        if (frame_dirty) {
+            pump_events(0);
+        } else {
+            // Nothing on screen would change, so block until something happens.
+            pump_events(IDLE_WAKEUP_MS);
+            frame_pacer.resume_after_idle();
+            prevFrame_ms = SDL_GetTicks();
+        }
+        render_frame();
     }
+
+    stop_sim_thread();
+
+    loader.reset();
+    the_telemetry.stop();
+
+    std::printf("%ld frames, %ld missed deadlines\n", frame_pacer.frames, frame_pacer.missed);
+    if (input_latency.n > 0) input_latency.print();
 #endif
 
     return 0;
@@ -0,0 +1,108 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+#include <SDL.h>
+#include <SDL_image.h>
+
+#include "assetpack.hpp"
+
+// Builds the asset pack (see assetpack.hpp) from the files in data/.
+//
+// usage: packassets out_path
+static void fail(const char * what, const char * path, const char * err)
+{
+    std::printf("%s(%s) failed: %s\n", what, path, err);
+    exit(1);
+}
+
+static void pad_to_alignment(std::vector<uint8_t> & blobs)
+{
+    while (blobs.size() % PACK_ALIGN) blobs.push_back(0);
+}
+
+int main(int argc, char ** argv)
+{
+    if (argc != 2) {
+        std::printf("usage: %s out_path\n", argv[0]);
+        return 1;
+    }
+
+    if (SDL_Init(0) < 0) fail("SDL_Init", "", SDL_GetError());
+    int flags = IMG_INIT_PNG;
+    if ((IMG_Init(flags) & flags) != flags) fail("IMG_Init", "", IMG_GetError());
+
+    std::vector<PackEntry> entries;
+    std::vector<uint8_t> blobs;
+
+    auto add_entry = [&](const char * name, uint32_t kind) -> PackEntry & {
+        PackEntry e;
+        memset(&e, 0, sizeof(e));
+        if (strlen(name) >= sizeof(e.name)) fail("add_entry", name, "name too long");
+        strcpy(e.name, name);
+        e.kind = kind;
+        pad_to_alignment(blobs);
+        e.offset = blobs.size();
+        entries.push_back(e);
+        return entries.back();
+    };
+
+    for (auto& a : SPRITE_ASSETS) {
+        SDL_Surface * loaded = IMG_Load(a.path);
+        if (!loaded) fail("IMG_Load", a.path, IMG_GetError());
+        SDL_Surface * rgba = SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_RGBA32, 0);
+        if (!rgba) fail("SDL_ConvertSurfaceFormat", a.path, SDL_GetError());
+        SDL_FreeSurface(loaded);
+
+        PackEntry & e = add_entry(a.path, PACK_KIND_IMAGE);
+        e.w = rgba->w;
+        e.h = rgba->h;
+        e.nframes = a.nframes;
+        e.size = rgba->w * rgba->h * 4;
+
+        if (SDL_LockSurface(rgba) < 0) fail("SDL_LockSurface", a.path, SDL_GetError());
+        for (int y = 0; y < rgba->h; ++y) {
+            uint8_t const * row = static_cast<uint8_t const *>(rgba->pixels) + y * rgba->pitch;
+            blobs.insert(blobs.end(), row, row + rgba->w * 4);
+        }
+        SDL_UnlockSurface(rgba);
+        SDL_FreeSurface(rgba);
+    }
+
+    {
+        std::ifstream f(FONT_ASSET, std::ios::binary);
+        if (!f) fail("open", FONT_ASSET, "cannot read");
+        std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+
+        PackEntry & e = add_entry(FONT_ASSET, PACK_KIND_FONT);
+        e.size = bytes.size();
+        blobs.insert(blobs.end(), bytes.begin(), bytes.end());
+    }
+
+    // Blob offsets so far are relative to the end of the entry table.
+    PackHeader header;
+    memcpy(header.magic, PACK_MAGIC, sizeof(header.magic));
+    header.version = PACK_VERSION;
+    header.nentries = entries.size();
+
+    size_t table_end = sizeof(PackHeader) + entries.size() * sizeof(PackEntry);
+    size_t blobs_start = (table_end + PACK_ALIGN - 1) / PACK_ALIGN * PACK_ALIGN;
+    for (auto& e : entries) e.offset += blobs_start;
+
+    std::ofstream out(argv[1], std::ios::binary);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(entries.data()), entries.size() * sizeof(PackEntry));
+    std::vector<char> padding(blobs_start - table_end, 0);
+    out.write(padding.data(), padding.size());
+    out.write(reinterpret_cast<const char *>(blobs.data()), blobs.size());
+    if (!out) fail("write", argv[1], "write error");
+
+    std::printf("wrote %zu entries, %zu bytes to %s\n", entries.size(), blobs_start + blobs.size(), argv[1]);
+
+    IMG_Quit();
+    SDL_Quit();
+    return 0;
+}
@@ -0,0 +1,78 @@
+#include "parallel.hpp"
+
+ThreadPool::ThreadPool(int nthreads)
+{
+    if (nthreads <= 0) nthreads = std::thread::hardware_concurrency();
+    if (nthreads <= 0) nthreads = 1;
+
+    for (int i = 1; i < nthreads; ++i) {
+        workers.emplace_back([this] { worker_main(); });
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mu);
+        stopping = true;
+    }
+    job_posted.notify_all();
+
+    for (auto& w : workers) {
+        w.join();
+    }
+}
+
+void ThreadPool::parallel_for(int n, std::function<void(int)> const & fn)
+{
+    if (n <= 0) return;
+
+    if (workers.empty() || n == 1) {
+        for (int i = 0; i < n; ++i) fn(i);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mu);
+        job = &fn;
+        job_n = n;
+        job_next = 0;
+        busy_workers = workers.size();
+        ++generation;
+    }
+    job_posted.notify_all();
+
+    run_job();
+
+    std::unique_lock<std::mutex> lock(mu);
+    job_finished.wait(lock, [this] { return busy_workers == 0; });
+    job = NULL;
+}
+
+void ThreadPool::worker_main()
+{
+    unsigned seen = 0;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mu);
+            job_posted.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+        }
+
+        run_job();
+
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            if (--busy_workers == 0) job_finished.notify_one();
+        }
+    }
+}
+
+void ThreadPool::run_job()
+{
+    for (int i; (i = job_next.fetch_add(1)) < job_n; ) {
+        (*job)(i);
+    }
+}
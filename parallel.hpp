@@ -0,0 +1,44 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads for data-parallel loops.
+// The calling thread takes part in every loop, so a pool of size 1 has no workers at all.
+struct ThreadPool
+{
+    // nthreads <= 0 means one thread per core.
+    explicit ThreadPool(int nthreads = 0);
+    ~ThreadPool();
+
+    ThreadPool(ThreadPool const &) = delete;
+    ThreadPool & operator=(ThreadPool const &) = delete;
+
+    int size() const { return static_cast<int>(workers.size()) + 1; }
+
+    // Calls fn(i) for every i in [0,n) and returns once all calls are done.
+    // Calls run concurrently, in no particular order.
+    void parallel_for(int n, std::function<void(int)> const & fn);
+
+private:
+    void worker_main();
+    void run_job();
+
+    std::vector<std::thread> workers;
+
+    std::mutex mu;
+    std::condition_variable job_posted;
+    std::condition_variable job_finished;
+    bool stopping = false;
+    unsigned generation = 0;
+    int busy_workers = 0;
+
+    std::function<void(int)> const * job = NULL;
+    int job_n = 0;
+    std::atomic<int> job_next{0};
+};
@@ -0,0 +1,141 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include "floorcache.hpp"
+#include "hex_dance_dungeon.hpp"
+#include "savegame.hpp"
+
+// Measures save_game / load_game latency against map size, on square maps
+// of floor with walls scattered about and an enemy every few dozen cells.
+// Then checks that a FloorCache evicts such maps at its budget, and brings
+// them back unchanged.
+//
+// usage: savebench [save_path=savebench.bin] [reps=20]
+
+GameState make_state(int side, unsigned seed)
+{
+    GameState state;
+    state.prng.seed(seed);
+
+    auto map = std::make_shared<MapData>();
+    map->path = "savebench";
+    map->min_s = -side/2;
+    map->min_t = -side/2;
+    map->n_s = side;
+    map->n_t = side;
+    map->tiles.resize(map->ncells());
+    FOR(i,map->ncells()) {
+        Tile & tile = map->tiles[i];
+        unsigned r = state.prng() % 16;
+        tile.type = r == 0 ? TileType::wall : r == 1 ? TileType::door : TileType::floor;
+        if (tile.type == TileType::door) tile.rotation = state.prng() % 3;
+    }
+    segment_rooms(*map);
+    state.shared_map = map;
+
+    resize_bits(state.is_visible, map->ncells());
+    resize_bits(state.tile_has_been_visible, map->ncells());
+    FOR(i,map->ncells()) {
+        if (state.prng() % 2) set_bit(state.tile_has_been_visible, i);
+    }
+
+    state.player.health = state.player.max_health;
+
+    int const TYPES = static_cast<int>(EntityType::skeleton_white);
+    for (int i = 0; i < map->ncells(); i += 37) {
+        Entity e;
+        e.s = map->s_of(i);
+        e.t = map->t_of(i);
+        e.type = static_cast<EntityType>(1 + i % TYPES);
+        e.moveCooldown = i % 3;
+        e.prep_dir = i % (NDIRS+1) - 1;
+        state.entities.push_back(e);
+    }
+
+    return state;
+}
+
+// Leaves four big floors in a cache with room for three and a half of them,
+// counting only their tiles and room_of. They hold more than that, so no more
+// than three may stay resident.
+bool check_floor_cache()
+{
+    int const SIDE = 1024;
+    int const FLOORS = 4;
+    size_t budget = size_t(SIDE) * SIDE * (sizeof(Tile) + sizeof(int)) * 7 / 2;
+
+    FloorCache floors(budget);
+    std::vector<uint8_t> first;
+    FOR(k,FLOORS) {
+        GameState state = make_state(SIDE, k + 1);
+        state.map_for_write().path = "floor" + std::to_string(k);
+        if (k == 0) write_game(state, first);
+        floors.put(std::move(state));
+    }
+
+    printf("floor cache: %d resident in %zu of %zu bytes, %d evicted\n",
+        floors.resident_count(), floors.resident_bytes(), budget, floors.evicted_count());
+    if (floors.resident_count() > FLOORS - 1 || floors.resident_count() + floors.evicted_count() != FLOORS) {
+        fprintf(stderr, "floor cache kept %d floors resident, wanted at most %d\n", floors.resident_count(), FLOORS - 1);
+        return false;
+    }
+
+    GameState back;
+    std::vector<uint8_t> again;
+    if (!floors.take("floor0", back)) {
+        fprintf(stderr, "floor cache lost floor0\n");
+        return false;
+    }
+    write_game(back, again);
+    if (again != first) {
+        fprintf(stderr, "floor cache changed floor0\n");
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char ** argv)
+{
+    std::string path = argc > 1 ? argv[1] : "savebench.bin";
+    int reps = argc > 2 ? atoi(argv[2]) : 20;
+
+    printf("%8s %10s %10s %10s %10s\n", "cells", "entities", "bytes", "save_ms", "load_ms");
+
+    for (int side = 32; side <= 2048; side *= 2) {
+        GameState state = make_state(side, side);
+        GameState loaded;
+
+        double save_s = 0, load_s = 0;
+        FOR(i,reps) {
+            auto start = std::chrono::steady_clock::now();
+            if (!save_game(state, path)) {
+                perror(path.c_str());
+                return 1;
+            }
+            auto mid = std::chrono::steady_clock::now();
+            if (!load_game(path, loaded)) {
+                fprintf(stderr, "load_game(%s) failed\n", path.c_str());
+                return 1;
+            }
+            auto end = std::chrono::steady_clock::now();
+
+            save_s += std::chrono::duration<double>(mid - start).count();
+            load_s += std::chrono::duration<double>(end - mid).count();
+        }
+
+        std::vector<uint8_t> a, b;
+        write_game(state, a);
+        write_game(loaded, b);
+        if (a != b) {
+            fprintf(stderr, "round trip changed the state at %dx%d\n", side, side);
+            return 1;
+        }
+
+        printf("%8d %10zu %10zu %10.3f %10.3f\n", state.map().ncells(), state.entities.size(),
+            a.size(), save_s / reps * 1000, load_s / reps * 1000);
+    }
+
+    remove(path.c_str());
+    return check_floor_cache() ? 0 : 1;
+}
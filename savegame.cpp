@@ -0,0 +1,436 @@
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+
+#include "savegame.hpp"
+
+namespace {
+
+// Writes into space the caller has already made room for.
+struct Writer
+{
+    uint8_t * p;
+
+    void u8(uint8_t x) { *p++ = x; }
+
+    void u32(uint32_t x)
+    {
+        p[0] = uint8_t(x);
+        p[1] = uint8_t(x >> 8);
+        p[2] = uint8_t(x >> 16);
+        p[3] = uint8_t(x >> 24);
+        p += 4;
+    }
+
+    void i32(int x) { u32(static_cast<uint32_t>(x)); }
+
+    // Seven bits a byte, low first; the top bit says more follow.
+    void var(uint32_t x)
+    {
+        while (x >= 0x80) {
+            *p++ = uint8_t(x | 0x80);
+            x >>= 7;
+        }
+        *p++ = uint8_t(x);
+    }
+
+    void bytes(void const * src, size_t n)
+    {
+        memcpy(p, src, n);
+        p += n;
+    }
+
+    void str(std::string const & s)
+    {
+        u32(s.size());
+        bytes(s.data(), s.size());
+    }
+
+    void bits(CellBits const & b)
+    {
+        u32(b.size());
+        for (uint64_t w : b) {
+            u32(static_cast<uint32_t>(w));
+            u32(static_cast<uint32_t>(w >> 32));
+        }
+    }
+};
+
+// Reads past the end set ok = false and return zeros, so callers check once at the end.
+struct Reader
+{
+    uint8_t const * p;
+    uint8_t const * end;
+    bool ok = true;
+
+    bool have(size_t n)
+    {
+        if (static_cast<size_t>(end - p) < n) ok = false;
+        return ok;
+    }
+
+    uint8_t u8()
+    {
+        if (!have(1)) return 0;
+        return *p++;
+    }
+
+    uint32_t u32()
+    {
+        if (!have(4)) return 0;
+        uint32_t x = p[0] | p[1] << 8 | p[2] << 16 | uint32_t(p[3]) << 24;
+        p += 4;
+        return x;
+    }
+
+    int i32() { return static_cast<int32_t>(u32()); }
+
+    uint32_t var()
+    {
+        // Most are one byte.
+        if (p < end && *p < 0x80) return *p++;
+
+        uint32_t x = 0;
+        for (int shift = 0; shift < 32; shift += 7) {
+            uint8_t b = u8();
+            x |= uint32_t(b & 0x7f) << shift;
+            if (!(b & 0x80)) return x;
+        }
+        ok = false;
+        return 0;
+    }
+
+    std::string str()
+    {
+        uint32_t n = u32();
+        if (!have(n)) return "";
+        std::string s(reinterpret_cast<char const *>(p), n);
+        p += n;
+        return s;
+    }
+
+    void bits(CellBits & b, int ncells)
+    {
+        uint32_t n = u32();
+        if (n != (static_cast<uint32_t>(ncells) + 63) / 64 || !have(8 * size_t(n))) {
+            ok = false;
+            return;
+        }
+        b.resize(n);
+        for (auto& w : b) {
+            uint64_t lo = u32();
+            w = lo | uint64_t(u32()) << 32;
+        }
+    }
+};
+
+size_t var_bytes(uint32_t x)
+{
+    size_t n = 1;
+    while (x >= 0x80) {
+        x >>= 7;
+        ++n;
+    }
+    return n;
+}
+
+// One byte per cell: type in the low bits, door rotation above.
+uint8_t pack_tile(Tile tile)
+{
+    return static_cast<uint8_t>(tile.type) | tile.rotation << 2;
+}
+
+Tile unpack_tile(uint8_t b)
+{
+    Tile tile;
+    tile.type = static_cast<TileType>(b & 3);
+    tile.rotation = b >> 2;
+    return tile;
+}
+
+int const ENTITY_BYTES = 12*4 + 5;
+
+void write_entity(Writer & w, Entity const & e)
+{
+    w.i32(e.s);
+    w.i32(e.t);
+    w.u8(static_cast<uint8_t>(e.type));
+    w.u8(static_cast<uint8_t>(e.last_motion));
+    w.i32(e.motion_s);
+    w.i32(e.motion_t);
+    w.u8(e.is_dead);
+    w.u8(e.has_been_visible);
+    w.i32(e.frameTelegraph);
+    w.i32(e.moveCooldownMax);
+    w.i32(e.moveCooldown);
+    w.i32(e.thinkCooldownMax);
+    w.i32(e.thinkCooldown);
+    w.i32(e.prep_dir);
+    w.i32(e.parity);
+    w.u8(e.hiding);
+    w.i32(e.momentum_dir);
+}
+
+void read_entity(Reader & r, Entity & e)
+{
+    e.s = r.i32();
+    e.t = r.i32();
+    e.type = static_cast<EntityType>(r.u8());
+    e.last_motion = static_cast<TweenType>(r.u8());
+    e.motion_s = r.i32();
+    e.motion_t = r.i32();
+    e.is_dead = r.u8();
+    e.has_been_visible = r.u8();
+    e.frameTelegraph = r.i32();
+    e.moveCooldownMax = r.i32();
+    e.moveCooldown = r.i32();
+    e.thinkCooldownMax = r.i32();
+    e.thinkCooldown = r.i32();
+    e.prep_dir = r.i32();
+    e.parity = r.i32();
+    e.hiding = r.u8();
+    e.momentum_dir = r.i32();
+
+    if (e.type == EntityType::none || e.type > EntityType::skeleton_white) r.ok = false;
+    if (e.last_motion > TweenType::bump) r.ok = false;
+    if (e.prep_dir < -1 || e.prep_dir >= NDIRS) r.ok = false;
+}
+
+}
+
+void write_game(GameState const & state, std::vector<uint8_t> & out)
+{
+    MapData const & map = state.map();
+
+    std::ostringstream prng;
+    prng << state.prng;
+    std::string prng_state = prng.str();
+
+    size_t size = 2*4
+        + 4 + map.path.size()
+        + 4*4 + map.tiles.size()
+        + 4 + map.lights.size() * 3*4
+        + 2*4
+        + 2*4 + (state.is_visible.size() + state.tile_has_been_visible.size()) * 8
+        + 6*4
+        + 4 + state.entities.size() * ENTITY_BYTES
+        + 4 + prng_state.size();
+
+    uint32_t nseen = 0;
+    FOR(r,static_cast<int>(map.room_parent.size())) {
+        size += var_bytes(map.room_parent[r] - r);
+        if (map.room_parent[r] != r) continue;
+        nseen += map.room_end[r] - map.room_begin[r];
+        size += var_bytes(map.room_end[r] - map.room_begin[r]);
+        int prev = 0;
+        FR(k,map.room_begin[r],map.room_end[r]) {
+            size += var_bytes(map.room_seen[k] - prev);
+            prev = map.room_seen[k];
+        }
+    }
+    for (int room : map.room_of) {
+        size += var_bytes(room + 1);
+    }
+
+    size_t start = out.size();
+    out.resize(start + size);
+    Writer w { out.data() + start };
+
+    w.u32(SAVE_MAGIC);
+    w.u32(SAVE_VERSION);
+
+    w.str(map.path);
+
+    w.i32(map.min_s);
+    w.i32(map.min_t);
+    w.i32(map.n_s);
+    w.i32(map.n_t);
+    FOR(i,map.ncells()) {
+        w.u8(pack_tile(map.tiles[i]));
+    }
+
+    w.u32(map.lights.size());
+    for (auto& light : map.lights) {
+        w.i32(light.s);
+        w.i32(light.t);
+        w.i32(light.radius);
+    }
+
+    // The rooms as doors have left them, so loading needn't find them again.
+    // Mostly small numbers, so they're varints: parents as how far on they
+    // are, and each root's sorted list of cells as the gaps between them.
+    assert(static_cast<int>(map.room_of.size()) == map.ncells());
+    w.u32(map.room_parent.size());
+    FOR(r,static_cast<int>(map.room_parent.size())) {
+        w.var(map.room_parent[r] - r);
+    }
+    for (int room : map.room_of) {
+        w.var(room + 1);
+    }
+    w.u32(nseen);
+    FOR(r,static_cast<int>(map.room_parent.size())) {
+        if (map.room_parent[r] != r) continue;
+        w.var(map.room_end[r] - map.room_begin[r]);
+        int prev = 0;
+        FR(k,map.room_begin[r],map.room_end[r]) {
+            w.var(map.room_seen[k] - prev);
+            prev = map.room_seen[k];
+        }
+    }
+
+    w.bits(state.is_visible);
+    w.bits(state.tile_has_been_visible);
+
+    w.i32(state.player.max_health);
+    w.i32(state.player.health);
+    w.i32(state.player_s);
+    w.i32(state.player_t);
+    w.i32(state.player_prev_s);
+    w.i32(state.player_prev_t);
+
+    w.u32(state.entities.size());
+    for (auto& e : state.entities) {
+        write_entity(w, e);
+    }
+
+    w.str(prng_state);
+
+    assert(w.p == out.data() + out.size());
+}
+
+bool read_game(uint8_t const * data, size_t size, GameState & out)
+{
+    Reader r { data, data + size };
+
+    if (r.u32() != SAVE_MAGIC) return false;
+    if (r.u32() != SAVE_VERSION) return false;
+
+    auto map = std::make_shared<MapData>();
+    map->path = r.str();
+    map->min_s = r.i32();
+    map->min_t = r.i32();
+    map->n_s = r.i32();
+    map->n_t = r.i32();
+    if (map->n_s < 0 || map->n_t < 0) return false;
+    if (map->n_t > 0 && map->n_s > (1 << 30) / map->n_t) return false;
+    if (!r.have(map->ncells())) return false;
+    map->tiles.resize(map->ncells());
+    FOR(i,map->ncells()) {
+        Tile tile = unpack_tile(r.p[i]);
+        if (tile.rotation >= 3) return false;
+        map->tiles[i] = tile;
+    }
+    r.p += map->ncells();
+
+    uint32_t nlights = r.u32();
+    if (!r.have(nlights * size_t(3*4))) return false;
+    map->lights.resize(nlights);
+    for (auto& light : map->lights) {
+        light.s = r.i32();
+        light.t = r.i32();
+        light.radius = r.i32();
+    }
+
+    // Parents come after their children (see open_door), so there are no cycles.
+    uint32_t nrooms = r.u32();
+    if (!r.have(nrooms)) return false;
+    map->room_parent.resize(nrooms);
+    FOR(k,static_cast<int>(nrooms)) {
+        uint32_t parent = k + r.var();
+        if (parent >= nrooms) return false;
+        map->room_parent[k] = parent;
+    }
+    if (!r.have(map->ncells())) return false;
+    map->room_of.resize(map->ncells());
+    for (int & room : map->room_of) {
+        uint32_t x = r.var();
+        if (x > nrooms) return false;
+        room = static_cast<int>(x) - 1;
+    }
+    uint32_t nseen = r.u32();
+    if (!r.have(nseen)) return false;
+    map->room_seen.reserve(nseen);
+    map->room_begin.assign(nrooms, 0);
+    map->room_end.assign(nrooms, 0);
+    FOR(k,static_cast<int>(nrooms)) {
+        if (map->room_parent[k] != k) continue;
+        uint32_t n = r.var();
+        if (!r.have(n)) return false;
+        map->room_begin[k] = map->room_seen.size();
+        uint32_t i = 0;
+        FOR(j,static_cast<int>(n)) {
+            uint32_t gap = r.var();
+            // Sorted without repeats, as open_door expects.
+            if (j > 0 && gap == 0) return false;
+            i += gap;
+            if (i >= static_cast<uint32_t>(map->ncells())) return false;
+            map->room_seen.push_back(i);
+        }
+        map->room_end[k] = map->room_seen.size();
+    }
+    if (map->room_seen.size() != nseen) return false;
+    out.shared_map = map;
+
+    r.bits(out.is_visible, map->ncells());
+    r.bits(out.tile_has_been_visible, map->ncells());
+
+    out.player.max_health = r.i32();
+    out.player.health = r.i32();
+    out.player_s = r.i32();
+    out.player_t = r.i32();
+    out.player_prev_s = r.i32();
+    out.player_prev_t = r.i32();
+
+    uint32_t nentities = r.u32();
+    if (!r.have(nentities)) return false;
+    out.entities.resize(nentities);
+    for (auto& e : out.entities) {
+        read_entity(r, e);
+    }
+
+    std::istringstream prng(r.str());
+    prng >> out.prng;
+    if (!prng) return false;
+
+    return r.ok && r.p == r.end;
+}
+
+bool save_game(GameState const & state, std::string const & path)
+{
+    std::vector<uint8_t> data;
+    write_game(state, data);
+
+    // Write next to it and rename over it, so a crash can't leave half a save.
+    std::string tmp_path = path + ".tmp";
+    FILE * f = fopen(tmp_path.c_str(), "wb");
+    if (!f) return false;
+
+    bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+    ok = fclose(f) == 0 && ok;
+    if (ok) ok = rename(tmp_path.c_str(), path.c_str()) == 0;
+    if (!ok) remove(tmp_path.c_str());
+    return ok;
+}
+
+bool load_game(std::string const & path, GameState & out)
+{
+    FILE * f = fopen(path.c_str(), "rb");
+    if (!f) return false;
+
+    std::vector<uint8_t> data;
+    bool ok = fseek(f, 0, SEEK_END) == 0;
+    long size = ok ? ftell(f) : -1;
+    ok = size >= 0 && fseek(f, 0, SEEK_SET) == 0;
+    if (ok) {
+        data.resize(size);
+        ok = fread(data.data(), 1, data.size(), f) == data.size();
+    }
+    fclose(f);
+
+    // Decode into a scratch state, so out is untouched on failure.
+    GameState state;
+    if (!ok || !read_game(data.data(), data.size(), state)) return false;
+    out = std::move(state);
+    return true;
+}
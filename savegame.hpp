@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "hex_dance_dungeon.hpp"
+
+// Compact binary encoding of a whole GameState: tiles (with doors as they are
+// now), lights, rooms, visibility, player, entities and the RNG.
+// Little-endian throughout.
+//
+// Layout: SAVE_MAGIC, SAVE_VERSION, then the fields in the order write_game
+// writes them. Readers reject other versions.
+uint32_t const SAVE_MAGIC = 0x53444448;  // "HDDS"
+uint32_t const SAVE_VERSION = 3;
+
+// Appends the encoding of state to out.
+void write_game(GameState const & state, std::vector<uint8_t> & out);
+
+// Decodes a game written by write_game into out. Returns false if the data
+// is truncated, corrupt or from another version; out is then unspecified.
+bool read_game(uint8_t const * data, size_t size, GameState & out);
+
+// Save files are one write_game encoding, written whole. Both return false
+// (with errno set for I/O errors) on failure; a failed save leaves any
+// previous file at path untouched.
+bool save_game(GameState const & state, std::string const & path);
+bool load_game(std::string const & path, GameState & out);
@@ -0,0 +1,274 @@
+#include <algorithm>
+#include <string>
+
+// https://github.com/nlohmann/json
+#include "nlohmann/json.hpp"
+
+#include "sight.hpp"
+
+using nlohmann::json;
+using std::make_pair;
+
+// Origins per parallel job: enough to pay for the job, few enough to balance.
+int const ORIGINS_PER_JOB = 256;
+
+static void put_varint(std::vector<uint8_t> & out, uint32_t v)
+{
+    while (v >= 0x80) {
+        out.push_back(static_cast<uint8_t>(v) | 0x80);
+        v >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(v));
+}
+
+// Returns false if the varint runs past end.
+static bool get_varint(uint8_t const * & p, uint8_t const * end, uint32_t & v)
+{
+    v = 0;
+    for (int shift = 0; p < end && shift < 35; shift += 7) {
+        uint8_t b = *p++;
+        v |= static_cast<uint32_t>(b & 0x7f) << shift;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+// The first cell at or after from whose bit is `want`, or n if there is none.
+static int find_bit(CellBits const & bits, int from, int n, bool want)
+{
+    if (from >= n) return n;
+    int w = from >> 6;
+    uint64_t word = (want ? bits[w] : ~bits[w]) & (~uint64_t(0) << (from & 63));
+    while (!word) {
+        if (++w >= static_cast<int>(bits.size())) return n;
+        word = want ? bits[w] : ~bits[w];
+    }
+    return std::min(n, (w << 6) + __builtin_ctzll(word));
+}
+
+static void encode_runs(CellBits const & bits, int n, std::vector<uint8_t> & out)
+{
+    std::vector<std::pair<int,int>> found;
+    for (int i = find_bit(bits, 0, n, true); i < n; ) {
+        int end = find_bit(bits, i, n, false);
+        found.push_back(make_pair(i, end));
+        i = find_bit(bits, end, n, true);
+    }
+
+    put_varint(out, found.size());
+    int prev_end = 0;
+    for (auto [ begin, end ] : found) {
+        put_varint(out, begin - prev_end);
+        put_varint(out, end - begin);
+        prev_end = end;
+    }
+}
+
+void SightTable::seen_runs(int o, std::vector<std::pair<int,int>> & out) const
+{
+    out.clear();
+    uint8_t const * p = runs.data() + run_begin[o];
+    uint8_t const * end = runs.data() + run_begin[o+1];
+
+    uint32_t n, gap, len;
+    get_varint(p, end, n);
+    int prev_end = 0;
+    FOR(k,static_cast<int>(n)) {
+        get_varint(p, end, gap);
+        get_varint(p, end, len);
+        int begin = prev_end + gap;
+        prev_end = begin + len;
+        out.push_back(make_pair(begin, prev_end));
+    }
+}
+
+bool SightTable::sees(int from, int to) const
+{
+    int o = origin_of[from];
+    if (o == -1) return false;
+
+    uint8_t const * p = runs.data() + run_begin[o];
+    uint8_t const * end = runs.data() + run_begin[o+1];
+
+    uint32_t n, gap, len;
+    get_varint(p, end, n);
+    int prev_end = 0;
+    FOR(k,static_cast<int>(n)) {
+        get_varint(p, end, gap);
+        get_varint(p, end, len);
+        int begin = prev_end + gap;
+        prev_end = begin + len;
+        if (to < begin) return false;
+        if (to < prev_end) return true;
+    }
+    return false;
+}
+
+static void find_origins(MapData const & map, SightTable & out)
+{
+    out.origins.clear();
+    out.origin_of.assign(map.ncells(), -1);
+    FOR(i,map.ncells()) {
+        if (map.tiles[i].type != TileType::floor) continue;
+        out.origin_of[i] = out.origins.size();
+        out.origins.push_back(i);
+    }
+}
+
+void find_regions(MapData const & map, SightTable & out)
+{
+    auto passable = [&](int i) {
+        return map.tiles[i].type == TileType::floor || map.tiles[i].type == TileType::door;
+    };
+
+    out.region_of.assign(map.ncells(), -1);
+    out.nregions = 0;
+
+    std::vector<int> stack;
+    FOR(start,map.ncells()) {
+        if (!passable(start) || out.region_of[start] != -1) continue;
+
+        int region = out.nregions++;
+        out.region_of[start] = region;
+        stack.push_back(start);
+        while (!stack.empty()) {
+            int i = stack.back();
+            stack.pop_back();
+
+            int s = map.s_of(i), t = map.t_of(i);
+            FOR(d,NDIRS) {
+                int j = map.index(s + DIR_DS[d], t + DIR_DT[d]);
+                if (j < 0 || out.region_of[j] != -1 || !passable(j)) continue;
+                out.region_of[j] = region;
+                stack.push_back(j);
+            }
+        }
+    }
+}
+
+void build_sight_table(GameState const & state, ThreadPool & pool, SightTable & out)
+{
+    MapData const & map = state.map();
+    find_origins(map, out);
+    find_regions(map, out);
+
+    // Each job encodes its origins into its own buffer; they are joined after.
+    int n_jobs = (out.norigins() + ORIGINS_PER_JOB - 1) / ORIGINS_PER_JOB;
+    std::vector<std::vector<uint8_t>> job_runs(n_jobs);
+    std::vector<std::vector<uint32_t>> job_sizes(n_jobs);
+
+    pool.parallel_for(n_jobs, [&](int job) {
+        // compute_visibility marks into the thread's game, so give it one
+        // that shares the map.
+        GameState scratch;
+        scratch.shared_map = state.shared_map;
+        resize_bits(scratch.is_visible, map.ncells());
+
+        GameState * prev_game = game;
+        game = &scratch;
+
+        int first = job * ORIGINS_PER_JOB;
+        int last = std::min(first + ORIGINS_PER_JOB, out.norigins());
+        FR(o,first,last) {
+            int i = out.origins[o];
+            std::fill(BEND(scratch.is_visible), 0);
+            compute_visibility(map.s_of(i), map.t_of(i));
+
+            size_t before = job_runs[job].size();
+            encode_runs(scratch.is_visible, map.ncells(), job_runs[job]);
+            job_sizes[job].push_back(job_runs[job].size() - before);
+        }
+
+        game = prev_game;
+    });
+
+    out.runs.clear();
+    out.run_begin.assign(1, 0);
+    FOR(job,n_jobs) {
+        out.runs.insert(out.runs.end(), BEND(job_runs[job]));
+        for (uint32_t size : job_sizes[job]) {
+            out.run_begin.push_back(out.run_begin.back() + size);
+        }
+    }
+}
+
+static char const BASE64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static std::string to_base64(std::vector<uint8_t> const & data)
+{
+    std::string out;
+    out.reserve((data.size() + 2) / 3 * 4);
+    for (size_t i = 0; i < data.size(); i += 3) {
+        uint32_t v = data[i] << 16;
+        if (i+1 < data.size()) v |= data[i+1] << 8;
+        if (i+2 < data.size()) v |= data[i+2];
+        out += BASE64[v >> 18 & 63];
+        out += BASE64[v >> 12 & 63];
+        out += i+1 < data.size() ? BASE64[v >> 6 & 63] : '=';
+        out += i+2 < data.size() ? BASE64[v & 63] : '=';
+    }
+    return out;
+}
+
+static bool from_base64(std::string const & text, std::vector<uint8_t> & out)
+{
+    int value[256];
+    std::fill(value, value + 256, -1);
+    FOR(k,64) value[static_cast<uint8_t>(BASE64[k])] = k;
+
+    out.clear();
+    uint32_t acc = 0;
+    int nbits = 0;
+    for (char c : text) {
+        if (c == '=') break;
+        int v = value[static_cast<uint8_t>(c)];
+        if (v < 0) return false;
+        acc = acc << 6 | v;
+        nbits += 6;
+        if (nbits >= 8) {
+            nbits -= 8;
+            out.push_back(acc >> nbits & 0xff);
+        }
+    }
+    return true;
+}
+
+json sight_to_json(SightTable const & sight)
+{
+    json j;
+    j["cells"] = sight.origin_of.size();
+    j["origins"] = sight.origins.size();
+    j["runs"] = to_base64(sight.runs);
+    return j;
+}
+
+bool sight_from_json(json const & j, MapData const & map, SightTable & out)
+{
+    if (!j.is_object() || !j.contains("cells") || !j.contains("origins") || !j.contains("runs")) return false;
+    if (j["cells"].get<int>() != map.ncells()) return false;
+
+    find_origins(map, out);
+    if (j["origins"].get<int>() != out.norigins()) return false;
+
+    if (!from_base64(j["runs"].get<std::string>(), out.runs)) return false;
+
+    // Walk the records to find where each origin's starts, checking as we go.
+    uint8_t const * p = out.runs.data();
+    uint8_t const * end = p + out.runs.size();
+    out.run_begin.assign(1, 0);
+    FOR(o,out.norigins()) {
+        uint32_t n, gap, len;
+        if (!get_varint(p, end, n)) return false;
+        long prev_end = 0;
+        FOR(k,static_cast<int>(n)) {
+            if (!get_varint(p, end, gap) || !get_varint(p, end, len)) return false;
+            prev_end += static_cast<long>(gap) + len;
+            if (prev_end > map.ncells()) return false;
+        }
+        out.run_begin.push_back(p - out.runs.data());
+    }
+    if (p != end) return false;
+
+    find_regions(map, out);
+    return true;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// https://github.com/nlohmann/json
+#include "nlohmann/json_fwd.hpp"
+
+#include "hex_dance_dungeon.hpp"
+#include "parallel.hpp"
+
+// What every floor tile of a map can see (by compute_visibility) and reach,
+// precomputed for level design tools and AI.
+//
+// Sight is kept per floor tile as the runs of cells it sees, in cell order:
+// a varint count of runs, then per run a pair of varints, the gap since the
+// end of the previous run and its length. Rooms are mostly whole rows of
+// cells, so this is a few bytes per row seen, against a bit per cell of the
+// map for a plain bitset.
+struct SightTable
+{
+    // Origins are the map's floor cells, in cell order.
+    std::vector<int> origins;
+    std::vector<int> origin_of;  // per cell: its origin, or -1 if not floor
+
+    // Origin o's runs are runs[run_begin[o], run_begin[o+1]).
+    std::vector<uint32_t> run_begin;
+    std::vector<uint8_t> runs;
+
+    // Per cell: the region it is in, moving through floor and doors
+    // (which can always be opened), or -1 for walls and empty cells.
+    std::vector<int> region_of;
+    int nregions = 0;
+
+    int norigins() const { return static_cast<int>(origins.size()); }
+
+    // The runs origin o sees, as [begin, end) cell ranges.
+    void seen_runs(int o, std::vector<std::pair<int,int>> & out) const;
+
+    // Does floor cell from see cell to? False if from is not floor.
+    bool sees(int from, int to) const;
+
+    bool reaches(int from, int to) const
+    {
+        return region_of[from] != -1 && region_of[from] == region_of[to];
+    }
+};
+
+// Runs compute_visibility from every floor tile of state's map, spread over pool.
+void build_sight_table(GameState const & state, ThreadPool & pool, SightTable & out);
+
+// Finds the regions of out from map; build_sight_table and
+// sight_from_json do this themselves.
+void find_regions(MapData const & map, SightTable & out);
+
+// For the "sight" key of a map file: the runs as base64 text, with the cell
+// count to check they belong to the map they are read back with. Regions are
+// cheap to find again, so they are not stored.
+//
+// Only tools read it back; load_map skips it. The game sees by room
+// (compute_visibility_plus), not by line of sight, and what it sees changes
+// as doors open, so a table of the map as drawn can't stand in for it.
+nlohmann::json sight_to_json(SightTable const & sight);
+
+// Returns false if j does not fit map; out is then unspecified.
+bool sight_from_json(nlohmann::json const & j, MapData const & map, SightTable & out);
@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+
+// https://github.com/nlohmann/json
+#include "nlohmann/json.hpp"
+
+#include "sight.hpp"
+
+using nlohmann::json;
+
+// Runs compute_visibility from every floor tile of a map on all cores, and
+// reports what is exposed, what is hidden and what can reach what. With
+// out_path, writes the map back out with the sight table under "sight", for
+// other tools (see sight_to_json).
+//
+// usage: sightmap [map_path=random] [threads=0] [out_path]
+
+// A floor tile seen from fewer floor tiles than this is a hidden pocket.
+int const POCKET_SEEN = 10;
+int const NLISTED = 10;
+
+json random_map_json();  // game.cpp
+
+static void print_tiles(MapData const & map, std::vector<int> const & cells, std::vector<long> const & seen_by)
+{
+    for (int i : cells) {
+        printf("  (%d,%d) seen from %ld\n", map.s_of(i), map.t_of(i), seen_by[i]);
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    std::string map_path = argc > 1 ? argv[1] : "random";
+    int n_threads = argc > 2 ? atoi(argv[2]) : 0;
+    std::string out_path = argc > 3 ? argv[3] : "";
+
+    GameState state;
+    game = &state;
+    warp_to_map(map_path);
+    MapData const & map = state.map();
+
+    ThreadPool pool(n_threads);
+
+    SightTable sight;
+    auto start = std::chrono::steady_clock::now();
+    build_sight_table(state, pool, sight);
+    double elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    int n = sight.norigins();
+    printf("%s: %d cells, %d floor tiles, %d regions\n", map_path.c_str(), map.ncells(), n, sight.nregions);
+    printf("%.3f s on %d threads, %.0f tiles/s\n", elapsed_s, pool.size(), n / elapsed_s);
+    printf("%zu bytes of runs, against %zu as bitsets\n", sight.runs.size(),
+            static_cast<size_t>(n) * ((map.ncells() + 7) / 8));
+    if (n == 0) return 0;
+
+    // seen_by[i]: how many floor tiles see cell i, by adding up the runs.
+    std::vector<long> seen_by(map.ncells() + 1, 0);
+    std::vector<std::pair<int,int>> runs;
+    long total_seen = 0;
+    int most_seeing = 0;
+    FOR(o,n) {
+        sight.seen_runs(o, runs);
+        long sees = 0;
+        for (auto [ begin, end ] : runs) {
+            ++seen_by[begin];
+            --seen_by[end];
+            sees += end - begin;
+        }
+        total_seen += sees;
+        most_seeing = std::max<long>(most_seeing, sees);
+    }
+    FR(i,1,map.ncells()) seen_by[i] += seen_by[i-1];
+
+    printf("a floor tile sees %.1f tiles on average, %d at most\n", total_seen / static_cast<double>(n), most_seeing);
+
+    std::vector<int> by_exposure = sight.origins;
+    std::stable_sort(BEND(by_exposure), [&](int a, int b) { return seen_by[a] > seen_by[b]; });
+    int nlisted = std::min(NLISTED, n);
+
+    printf("most exposed:\n");
+    print_tiles(map, std::vector<int>(by_exposure.begin(), by_exposure.begin() + nlisted), seen_by);
+
+    int pockets = 0;
+    for (int i : sight.origins) pockets += seen_by[i] < POCKET_SEEN;
+    printf("hidden pockets (seen from fewer than %d floor tiles): %d\n", POCKET_SEEN, pockets);
+    print_tiles(map, std::vector<int>(by_exposure.end() - nlisted, by_exposure.end()), seen_by);
+
+    std::vector<int> region_size(sight.nregions, 0);
+    for (int i : sight.origins) ++region_size[sight.region_of[i]];
+    int player = map.index(state.player_s, state.player_t);
+    int reachable = player >= 0 && sight.region_of[player] != -1 ? region_size[sight.region_of[player]] : 0;
+    printf("largest region: %d floor tiles; %d of %d reachable from the start\n",
+            *std::max_element(BEND(region_size)), reachable, n);
+
+    if (!out_path.empty()) {
+        if (map_path.compare(0, 7, "stress:") == 0) {
+            fprintf(stderr, "stress maps are generated, not read from JSON; not writing %s\n", out_path.c_str());
+            return 1;
+        }
+
+        json j;
+        if (map_path == "random") {
+            j = random_map_json();
+        } else {
+            std::ifstream i(map_path);
+            i >> j;
+        }
+        j["sight"] = sight_to_json(sight);
+
+        // Read it back, so a bad table never gets written.
+        SightTable check;
+        if (!sight_from_json(j["sight"], map, check) || check.runs != sight.runs || check.run_begin != sight.run_begin) {
+            fprintf(stderr, "sight table does not read back\n");
+            return 1;
+        }
+
+        std::ofstream o(out_path);
+        o << j.dump() << "\n";
+        printf("wrote %s\n", out_path.c_str());
+    }
+
+    return 0;
+}
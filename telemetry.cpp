@@ -0,0 +1,144 @@
+#include <chrono>
+
+#include "hex_dance_dungeon.hpp"
+#include "telemetry.hpp"
+
+thread_local Telemetry * telemetry = NULL;
+
+// How long the writer sleeps once the ring is empty.
+int const WRITE_INTERVAL_MS = 20;
+
+static int64_t steady_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Telemetry::Telemetry(int capacity)
+{
+    uint64_t n = 1;
+    while (n < static_cast<uint64_t>(capacity)) n <<= 1;
+    slots.reset(new Slot[n]);
+    mask = n - 1;
+    FOR(i,static_cast<int>(n)) slots[i].seq.store(i, std::memory_order_relaxed);
+    epoch_ns = steady_ns();
+}
+
+Telemetry::~Telemetry()
+{
+    stop();
+}
+
+bool Telemetry::start(std::string const & path)
+{
+    stop();
+    out = fopen(path.c_str(), "w");
+    if (!out) return false;
+    stopping = false;
+    writer = std::thread([this] { writer_main(); });
+    return true;
+}
+
+void Telemetry::stop()
+{
+    if (!writer.joinable()) return;
+    stopping = true;
+    writer.join();
+
+    write_pending();
+    if (dropped > 0) fprintf(out, "{\"event\":\"dropped\",\"count\":%ld}\n", dropped.load());
+    fclose(out);
+    out = NULL;
+}
+
+int64_t Telemetry::now_ns() const
+{
+    return steady_ns() - epoch_ns;
+}
+
+// A bounded multi-producer queue (Vyukov's): a push claims a position by
+// advancing head, fills the slot, then publishes it through the slot's seq.
+void Telemetry::push(TelemetryType type, int a, int b, int c)
+{
+    uint64_t pos = head.load(std::memory_order_relaxed);
+    Slot * slot;
+    while (true) {
+        slot = &slots[pos & mask];
+        int64_t diff = static_cast<int64_t>(slot->seq.load(std::memory_order_acquire) - pos);
+        if (diff == 0) {
+            if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+        } else if (diff < 0) {
+            // Still holding an event from a lap ago: the ring is full.
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        } else {
+            pos = head.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->event = { now_ns(), type, a, b, c };
+    slot->seq.store(pos + 1, std::memory_order_release);
+}
+
+bool Telemetry::pop(TelemetryEvent & event)
+{
+    Slot & slot = slots[tail & mask];
+    if (slot.seq.load(std::memory_order_acquire) != tail + 1) return false;
+    event = slot.event;
+    slot.seq.store(tail + mask + 1, std::memory_order_release);
+    ++tail;
+    return true;
+}
+
+static const char * entity_name(int type)
+{
+    return Entity::serialize_type(static_cast<EntityType>(type));
+}
+
+static const char * const PHASE_NAMES[] = { "act", "visibility", "enemies" };
+
+void Telemetry::write_pending()
+{
+    TelemetryEvent e;
+    while (pop(e)) {
+        long long ns = e.ns;
+        switch (e.type) {
+        case TelemetryType::turn_start:
+            fprintf(out, "{\"ns\":%lld,\"event\":\"turn_start\",\"dir\":%d,\"s\":%d,\"t\":%d}\n", ns, e.a, e.b, e.c);
+            break;
+        case TelemetryType::turn_end:
+            fprintf(out, "{\"ns\":%lld,\"event\":\"turn_end\",\"health\":%d,\"s\":%d,\"t\":%d}\n", ns, e.a, e.b, e.c);
+            break;
+        case TelemetryType::phase:
+            fprintf(out, "{\"ns\":%lld,\"event\":\"phase\",\"phase\":\"%s\",\"phase_ns\":%d}\n", ns, PHASE_NAMES[e.a], e.b);
+            break;
+        case TelemetryType::player_hit:
+            fprintf(out, "{\"ns\":%lld,\"event\":\"player_hit\",\"by\":\"%s\",\"s\":%d,\"t\":%d}\n", ns, entity_name(e.a), e.b, e.c);
+            break;
+        case TelemetryType::enemy_killed:
+            fprintf(out, "{\"ns\":%lld,\"event\":\"enemy_killed\",\"type\":\"%s\",\"s\":%d,\"t\":%d}\n", ns, entity_name(e.a), e.b, e.c);
+            break;
+        case TelemetryType::enemy_woke:
+            fprintf(out, "{\"ns\":%lld,\"event\":\"enemy_woke\",\"type\":\"%s\",\"s\":%d,\"t\":%d}\n", ns, entity_name(e.a), e.b, e.c);
+            break;
+        case TelemetryType::door_opened:
+            fprintf(out, "{\"ns\":%lld,\"event\":\"door_opened\",\"s\":%d,\"t\":%d}\n", ns, e.b, e.c);
+            break;
+        case TelemetryType::bad_tile:
+            fprintf(out, "{\"ns\":%lld,\"event\":\"bad_tile\",\"s\":%d,\"t\":%d}\n", ns, e.b, e.c);
+            break;
+        case TelemetryType::input_latency:
+            fprintf(out, "{\"ns\":%lld,\"event\":\"input_latency\",\"turn\":%d,\"latency_us\":%d}\n", ns, e.a, e.b);
+            break;
+        }
+    }
+    fflush(out);
+}
+
+void Telemetry::writer_main()
+{
+    while (!stopping) {
+        write_pending();
+        std::this_thread::sleep_for(std::chrono::milliseconds(WRITE_INTERVAL_MS));
+    }
+}
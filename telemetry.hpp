@@ -0,0 +1,97 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+
+// Structured game events, for offline analysis.
+//
+// Events go into a preallocated ring without locks or allocation, and a
+// writer thread drains it to a file, one JSON object per line. Pushing never
+// waits: if the writer falls a whole ring behind, events are dropped and
+// counted instead. Any number of threads may push; only the writer pops.
+//
+// The game core pushes to the thread's `telemetry`, when it has one, so
+// threads that only play games in the background (the loader, the bots)
+// record nothing.
+
+enum class TelemetryType : uint8_t
+{
+    turn_start,     // a: dir, b,c: player s,t
+    turn_end,       // a: player health, b,c: player s,t
+    phase,          // a: TelemetryPhase, b: nanoseconds
+    player_hit,     // a: EntityType of the attacker, b,c: its s,t
+    enemy_killed,   // a: EntityType, b,c: s,t
+    enemy_woke,     // a: EntityType, b,c: s,t
+    door_opened,    // b,c: s,t
+    bad_tile,       // b,c: s,t of a TileType::none tile met while drawing
+    input_latency,  // a: turn, b: microseconds from key press to the frame showing it
+};
+
+// The phases of a turn; see move_player.
+enum class TelemetryPhase : uint8_t
+{
+    act,
+    visibility,
+    enemies,
+};
+
+struct TelemetryEvent
+{
+    // Since the Telemetry was made.
+    int64_t ns;
+    TelemetryType type;
+    int32_t a, b, c;
+};
+
+struct Telemetry
+{
+    // capacity is rounded up to a power of two.
+    explicit Telemetry(int capacity = 1 << 16);
+    ~Telemetry();
+
+    Telemetry(Telemetry const &) = delete;
+    Telemetry & operator=(Telemetry const &) = delete;
+
+    // Opens path and starts the writer. Returns false if path can't be opened.
+    bool start(std::string const & path);
+    // Writes whatever is left, then stops the writer and closes the file.
+    void stop();
+    bool is_running() const { return writer.joinable(); }
+
+    void push(TelemetryType type, int a = 0, int b = 0, int c = 0);
+
+    int64_t now_ns() const;
+
+    // Events dropped because the ring was full.
+    std::atomic<long> dropped{0};
+
+private:
+    struct Slot
+    {
+        // Which push may fill it (== position), or which pop may empty it (== position + 1).
+        std::atomic<uint64_t> seq;
+        TelemetryEvent event;
+    };
+
+    std::unique_ptr<Slot[]> slots;
+    uint64_t mask;
+    std::atomic<uint64_t> head{0};
+    // Writer only.
+    uint64_t tail = 0;
+
+    int64_t epoch_ns;
+
+    FILE * out = NULL;
+    std::thread writer;
+    std::atomic<bool> stopping{false};
+
+    bool pop(TelemetryEvent & event);
+    void write_pending();
+    void writer_main();
+};
+
+extern thread_local Telemetry * telemetry;
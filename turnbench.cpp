@@ -0,0 +1,85 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+
+#include "hex_dance_dungeon.hpp"
+
+// Times whole turns, split into their phases (player_act,
+// compute_visibility_plus, Entity::move_enemies), with seeded random player
+// input, on every builtin map and on stress maps (see load_stress_map) with
+// many entities.
+// Games that end are restarted from a copy of the start, off the clock.
+// Each map stops early once MAX_SECONDS of turns have been timed, so the
+// largest maps play fewer turns; the times are per turn either way.
+//
+// Prints one JSON object per map per line, so runs of two commits can be
+// diffed or loaded side by side.
+//
+// usage: turnbench [turns=2000] [seed=1] [map_path...]
+
+double const MAX_SECONDS = 2.0;
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char ** argv)
+{
+    int n_turns = argc > 1 ? atoi(argv[1]) : 2000;
+    unsigned seed = argc > 2 ? atoi(argv[2]) : 1;
+
+    std::vector<std::string> maps = BUILTIN_MAPS;
+    maps.push_back("stress:tiles=10000");
+    maps.push_back("stress:tiles=100000");
+    maps.push_back("stress:tiles=1000000");
+    maps.push_back("stress:tiles=1000000,room=6,ghost=25000,skeleton_white=25000,bat_blue=25000,slime_blue=25000");
+    if (argc > 3) maps.assign(argv + 3, argv + argc);
+
+    for (auto& map_path : maps) {
+        GameState start;
+        start.prng.seed(seed);
+        game = &start;
+        warp_to_map(map_path);
+
+        GameState state = start;
+        game = &state;
+
+        std::minstd_rand rng(seed);
+        std::uniform_int_distribution<int> action_dist(-1, NDIRS-1);
+
+        double act_s = 0, visibility_s = 0, enemies_s = 0;
+        int turns = 0, restarts = 0;
+        for (; turns < n_turns && act_s + visibility_s + enemies_s < MAX_SECONDS; ++turns) {
+            if (state.is_won() || state.is_lost()) {
+                state = start;
+                ++restarts;
+            }
+            int dir = action_dist(rng);
+
+            auto t0 = std::chrono::steady_clock::now();
+            bool acted = player_act(dir);
+            act_s += seconds_since(t0);
+            if (!acted) continue;
+
+            auto t1 = std::chrono::steady_clock::now();
+            compute_visibility_plus();
+            visibility_s += seconds_since(t1);
+
+            auto t2 = std::chrono::steady_clock::now();
+            Entity::move_enemies();
+            enemies_s += seconds_since(t2);
+        }
+
+        double total_s = act_s + visibility_s + enemies_s;
+        printf("{\"map\":\"%s\",\"cells\":%d,\"entities\":%zu,\"turns\":%d,\"restarts\":%d,"
+                "\"turns_per_s\":%.0f,\"act_ns\":%.0f,\"visibility_ns\":%.0f,\"enemies_ns\":%.0f}\n",
+                map_path.c_str(), start.map().ncells(), start.entities.size(), turns, restarts,
+                turns / total_s, act_s / turns * 1e9, visibility_s / turns * 1e9, enemies_s / turns * 1e9);
+        fflush(stdout);
+    }
+
+    return 0;
+}
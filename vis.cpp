@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cstdlib>
 #include <utility>
 #include <vector>
 
@@ -21,9 +23,13 @@ static bool operator<=(Slope const & a, Slope const & b)
     return !(b < a);
 }
 
-static int origin_s;
-static int origin_t;
-static int nrot;
+// Tiles further than max_dist from the origin are never marked.
+int const UNLIMITED_DIST = 1 << 28;
+
+static thread_local int origin_s;
+static thread_local int origin_t;
+static thread_local int nrot;
+static thread_local int max_dist;
 static std::tuple<int,int> st_of_xy(int x, int y)
 {
     int s = (2*x-y)/3;
@@ -41,7 +47,9 @@ static std::tuple<int,int> st_of_xy(int x, int y)
 static void mark_visible_xy(int x, int y)
 {
     auto [ s, t ] = st_of_xy(x, y);
-    mark_tile_visible(s, t);
+    if (max_dist == UNLIMITED_DIST || hex_dist(origin_s, origin_t, s, t) <= max_dist) {
+        mark_tile_visible(s, t);
+    }
 }
 
 static bool is_tile_opaque_xy(int x, int y)
@@ -50,15 +58,14 @@ static bool is_tile_opaque_xy(int x, int y)
     return is_tile_opaque(s, t);
 }
 
-static std::vector<std::tuple<Slope, Slope>> vis_ivls;
-static std::vector<std::tuple<Slope, Slope>> next_vis_ivls;
+static thread_local std::vector<std::tuple<Slope, Slope>> vis_ivls;
+static thread_local std::vector<std::tuple<Slope, Slope>> next_vis_ivls;
 
-static void process_one_rot()
+// Carries on from row first_x, with vis_ivls what is still lit there.
+// Row x holds no tile nearer than x/2, so it stops after row 2*max_dist.
+static void process_one_rot(int first_x)
 {
-    vis_ivls.clear();
-    vis_ivls.push_back(make_tuple(Slope {0,1}, Slope {1,1}));
-
-    for (int x = 2; !vis_ivls.empty(); ++x) {
+    for (int x = first_x; !vis_ivls.empty() && x <= 2*max_dist; ++x) {
         next_vis_ivls.clear();
 
         for (auto [ vis_open, vis_close ] : vis_ivls) {
@@ -95,13 +102,204 @@ static void process_one_rot()
     }
 }
 
-void compute_visibility(int origin_s, int origin_t)
+void compute_visibility_reference(int origin_s, int origin_t)
+{
+    ::origin_s = origin_s;
+    ::origin_t = origin_t;
+    max_dist = UNLIMITED_DIST;
+
+    mark_tile_visible(origin_s, origin_t);
+    for (nrot = 0; nrot < 6; ++nrot) {
+        vis_ivls.clear();
+        vis_ivls.push_back(make_tuple(Slope {0,1}, Slope {1,1}));
+        process_one_rot(2);
+    }
+}
+
+// Precomputed traversal
+//
+// Which tiles process_one_rot visits, and the slopes each one spans, depend
+// only on (x, y), never on the origin or the map. So the tiles out to
+// VIS_TABLE_ROWS are listed once, in the order it visits them, with their
+// offsets already rotated into each sextant.
+//
+// Every slope a listed tile starts or ends at is a breakpoint, and the gaps
+// between consecutive breakpoints are bins. Each tile spans a run of whole
+// bins, so shadows are exactly ranges of bins, compared as plain integers.
+int const VIS_TABLE_ROWS = 64;
+
+struct VisTableEntry
+{
+    uint16_t lo_bin, hi_bin;
+    // Offset from the origin in each rotation, and its length.
+    int8_t ds[6], dt[6];
+    uint8_t dist;
+};
+
+struct VisTable
+{
+    std::vector<VisTableEntry> entries;
+    // Entries for row x are [row_begin[x], row_begin[x+1]).
+    std::vector<int> row_begin;
+    int nbins = 0;
+    // Bin b spans slopes (bin_edge[b], bin_edge[b+1]).
+    std::vector<Slope> bin_edge;
+    // next_entry[x*nbins + bin]: the first entry of row x that ends past bin,
+    // or row_begin[x+1] if none does.
+    std::vector<uint16_t> next_entry;
+};
+
+static int gcd(int a, int b)
+{
+    while (b) {
+        int r = a % b;
+        a = b;
+        b = r;
+    }
+    return a;
+}
+
+static VisTable build_vis_table()
+{
+    // Visited tiles of each row: yc = 3k - x, spanning slopes ((yc-1)/x, (yc+1)/x)
+    // clipped to the sextant's (0, 1).
+    auto clip = [](int num, int x) { return make_pair(std::max(0, std::min(num, x)), x); };
+    auto reduce = [](std::pair<int,int> f) {
+        int g = gcd(f.first, f.second);
+        return make_pair(f.first / g, f.second / g);
+    };
+    auto less = [](std::pair<int,int> a, std::pair<int,int> b) {
+        return a.first * b.second < b.first * a.second;
+    };
+
+    std::vector<std::pair<int,int>> points;
+    FR(x,2,VIS_TABLE_ROWS+1) {
+        for (int yc = positive_mod(-x, 3); yc <= x; yc += 3) {
+            points.push_back(reduce(clip(yc-1, x)));
+            points.push_back(reduce(clip(yc+1, x)));
+        }
+    }
+    std::sort(BEND(points), less);
+    points.erase(std::unique(BEND(points)), points.end());
+
+    auto bin_of = [&](std::pair<int,int> f) {
+        return static_cast<int>(std::lower_bound(BEND(points), reduce(f), less) - points.begin());
+    };
+
+    VisTable table;
+    table.nbins = points.size() - 1;
+    for (auto [ dy, dx ] : points) table.bin_edge.push_back(Slope {dy, dx});
+    table.row_begin.assign(VIS_TABLE_ROWS+2, 0);
+    FR(x,2,VIS_TABLE_ROWS+1) {
+        table.row_begin[x] = table.entries.size();
+        for (int yc = positive_mod(-x, 3); yc <= x; yc += 3) {
+            VisTableEntry e;
+            e.lo_bin = bin_of(clip(yc-1, x));
+            e.hi_bin = bin_of(clip(yc+1, x));
+
+            int s = (2*x-yc)/3;
+            int t = (2*yc-x)/3;
+            int p = -s-t;
+            e.dist = std::max({ abs(s), abs(t), abs(p) });
+            FOR(rot,6) {
+                e.ds[rot] = s;
+                e.dt[rot] = t;
+                std::tie(s,t,p) = make_tuple(-p,-s,-t);
+            }
+
+            table.entries.push_back(e);
+        }
+    }
+    table.row_begin[VIS_TABLE_ROWS+1] = table.entries.size();
+
+    table.next_entry.assign((VIS_TABLE_ROWS+1) * table.nbins, 0);
+    FR(x,2,VIS_TABLE_ROWS+1) {
+        int i = table.row_begin[x];
+        FOR(bin,table.nbins) {
+            while (i < table.row_begin[x+1] && table.entries[i].hi_bin <= bin) ++i;
+            table.next_entry[x*table.nbins + bin] = i;
+        }
+    }
+
+    return table;
+}
+
+typedef std::pair<int,int> BinRange;
+static thread_local std::vector<BinRange> lit_bins;
+static thread_local std::vector<BinRange> next_lit_bins;
+
+// One sextant by the table, out to max_dist. Returns false if sight reaches
+// past the table, leaving in lit_bins what is still lit beyond it.
+//
+// Like process_one_rot, it keeps the unshadowed ranges, but as bins: each
+// range starts at the first tile next_entry gives for it, and the tiles are
+// read off the table in order.
+static bool process_one_rot_by_table(VisTable const & table, int rot, int s0, int t0, int max_dist)
+{
+    // Once, rather than through the thread_locals on every tile.
+    std::vector<BinRange> & lit = lit_bins;
+    std::vector<BinRange> & next_lit = next_lit_bins;
+    VisTableEntry const * entries = table.entries.data();
+    int nbins = table.nbins;
+
+    lit.clear();
+    lit.push_back(make_pair(0, nbins));
+
+    int last_x = std::min(VIS_TABLE_ROWS, 2*max_dist);
+    FR(x,2,last_x+1) {
+        if (lit.empty()) return true;
+
+        int row_end = table.row_begin[x+1];
+        uint16_t const * next_entry = &table.next_entry[x*nbins];
+        next_lit.clear();
+
+        for (auto [ lo, hi ] : lit) {
+            int open = lo;
+            for (int i = next_entry[lo]; i < row_end && entries[i].lo_bin < hi; ++i) {
+                VisTableEntry const & e = entries[i];
+                int s = s0 + e.ds[rot];
+                int t = t0 + e.dt[rot];
+                if (e.dist <= max_dist) mark_tile_visible(s, t);
+                if (is_tile_opaque(s, t)) {
+                    if (open < e.lo_bin) next_lit.push_back(make_pair(open, e.lo_bin));
+                    open = e.hi_bin;
+                }
+            }
+            if (open < hi) next_lit.push_back(make_pair(open, hi));
+        }
+
+        std::swap(lit, next_lit);
+    }
+    return lit.empty() || last_x < VIS_TABLE_ROWS;
+}
+
+static void shadowcast(int origin_s, int origin_t, int max_dist)
 {
+    static VisTable const table = build_vis_table();
+
     ::origin_s = origin_s;
     ::origin_t = origin_t;
+    ::max_dist = max_dist;
 
     mark_tile_visible(origin_s, origin_t);
     for (nrot = 0; nrot < 6; ++nrot) {
-        process_one_rot();
+        if (process_one_rot_by_table(table, nrot, origin_s, origin_t, max_dist)) continue;
+
+        // Past the table, go on the slow way.
+        vis_ivls.clear();
+        for (auto [ lo, hi ] : lit_bins) {
+            vis_ivls.push_back(make_tuple(table.bin_edge[lo], table.bin_edge[hi]));
+        }
+        process_one_rot(VIS_TABLE_ROWS+1);
     }
 }
+
+void compute_visibility(int origin_s, int origin_t)
+{
+    shadowcast(origin_s, origin_t, UNLIMITED_DIST);
+}
+
+void compute_visibility_within(int origin_s, int origin_t, int radius)
+{
+    shadowcast(origin_s, origin_t, std::max(radius, 0));
+}